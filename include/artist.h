@@ -37,6 +37,41 @@ VocagtkArtist *vocagtk_artist_new(
     AppState *ctx
 );
 
+/*!
+ * @brief
+ *   Creates many artist objects at once without blocking.
+ *
+ *   Ids already in the local database are read with a single query right
+ *   away. The missing ones are fetched from VocaDB concurrently and saved
+ *   to the local database in one transaction.
+ *
+ * @param ids
+ *   The ids of the artists in VocaDB, duplicates are fetched once.
+ * @param n
+ *   The number of ids.
+ * @param ctx
+ *   Application state.
+ * @param cancellable
+ *   Aborts the fetches, may be NULL.
+ * @param callback
+ *   Called on the main thread once every artist is loaded, finish with
+ *   vocagtk_artist_new_many_finish.
+ */
+void vocagtk_artist_new_many_async(
+    VocagtkArtistId const *ids, gsize n,
+    AppState *ctx, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+);
+
+/*!
+ * @returns
+ *   A GPtrArray of new VocagtkArtist instances in the order of ids, or NULL
+ *   with error set. Ids which could neither be read nor fetched are left
+ *   out, unlike vocagtk_artist_new there are no placeholders.
+ *   The returned array is owned by the caller and unrefs its elements.
+ */
+GPtrArray *vocagtk_artist_new_many_finish(GAsyncResult *res, GError **error);
+
 /*!
  * @brief Gets the id of the artist in VocaDB.
  *
@@ -24,6 +24,8 @@ VocagtkSong *db_song_get_by_id(sqlite3 *db, int id, int *sql_err);
 
 int db_insert_song_albums(sqlite3 *db, yyjson_val *song_json, int *sql_err);
 int db_insert_song_artists(sqlite3 *db, yyjson_val *song_json, int *sql_err);
+// Song with its album and artist relations, as found in update results
+int db_song_store_from_json(sqlite3 *db, yyjson_val *song_json);
 
 // Add artist to RSS subscription
 // Returns: number of rows inserted (1 if newly inserted, 0 if already exists)
@@ -32,6 +34,109 @@ int db_rss_add_artist(sqlite3 *db, int artist_id, int *sql_err);
 int db_rss_remove_artist(sqlite3 *db, int artist_id);
 
 int db_entry_add(sqlite3 *db, VocagtkEntry const *entry);
+// Append a new VocagtkEntry to out for every stored entry whose name
+// contains query, at most limit of each type. entry_type is one of the
+// search types, an empty one matches all of them.
+int db_entry_search(
+    sqlite3 *db, char const *query, char const *entry_type,
+    int limit, GPtrArray *out
+);
+
+// Batch lookups, every entry found is inserted into out, which maps
+// GINT_TO_POINTER(id) to a new object. Ids missing in db are left out.
+int db_album_get_by_ids(sqlite3 *db, int const *ids, gsize n, GHashTable *out);
+int db_artist_get_by_ids(sqlite3 *db, int const *ids, gsize n, GHashTable *out);
+int db_song_get_by_ids(sqlite3 *db, int const *ids, gsize n, GHashTable *out);
+
+// How db_load_many_async reads, fetches and stores one kind of entry
+typedef struct {
+    int (*get_by_ids)(sqlite3 *db, int const *ids, gsize n, GHashTable *out);
+    void (*fetch_async)(
+        VocagtkDownloader *dl, int const *ids, gsize n,
+        GCancellable *cancellable, gint64 deadline,
+        GAsyncReadyCallback callback, gpointer user_data
+    );
+    gpointer (*from_json)(yyjson_val *json);
+    int (*store)(sqlite3 *db, yyjson_val *json);
+} DbLoadManyFuncs;
+
+// Objects for ids, in their order. The ones in db are read with a single
+// query right away, the missing ones are fetched once each through dl and
+// stored in one transaction. Ids which could be neither read nor fetched
+// are left out. Completes without network if every id is in db.
+void db_load_many_async(
+    sqlite3 *db, VocagtkDownloader *dl, DbLoadManyFuncs const *funcs,
+    int const *ids, gsize n, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+);
+// Returns an array which unrefs its elements, or NULL with error set.
+GPtrArray *db_load_many_finish(GAsyncResult *res, GError **error);
+
+// Group writes into one transaction
+int db_begin(sqlite3 *db);
+int db_commit(sqlite3 *db);
+int db_rollback(sqlite3 *db);
+// Savepoints nest inside a transaction or start one, db_rollback_to
+// undoes and closes the savepoint
+int db_savepoint(sqlite3 *db, char const *name);
+int db_release(sqlite3 *db, char const *name);
+int db_rollback_to(sqlite3 *db, char const *name);
+
+// Progress of an artist update which did not finish, saved after every
+// page so an interrupted update resumes where it stopped
+typedef struct {
+    time_t since; // update_at of the artist when the update began
+    size_t next_start; // results already stored
+    time_t newest; // newest publish date stored, bounds the resumed query
+    int last_song_id; // last song stored, -1 if none
+} DbSyncCheckpoint;
+
+// Returns SQLITE_ROW if a checkpoint was found, SQLITE_DONE if not
+int db_sync_get(sqlite3 *db, int artist_id, DbSyncCheckpoint *cp);
+int db_sync_save(sqlite3 *db, int artist_id, DbSyncCheckpoint const *cp);
+int db_sync_clear(sqlite3 *db, int artist_id);
+
+// When an artist was last asked for new songs and how often it released
+// some lately, the background sync polls it accordingly
+typedef struct {
+    int artist_id;
+    time_t polled_at; // 0 if never
+    int releases; // recent songs counted, at most the samples asked for
+    time_t latest; // publish dates of the newest and oldest of them
+    time_t oldest;
+} DbPollCadence;
+
+int db_rss_set_polled(sqlite3 *db, int artist_id, time_t polled_at);
+// Append a DbPollCadence to out for every subscribed artist, learned from
+// the publish dates of its newest samples songs
+int db_rss_get_cadence(sqlite3 *db, int samples, GArray *out);
+
+// One result of a remote search
+typedef struct {
+    VocagtkEntryTypeLabel type;
+    int id;
+} DbSearchHit;
+
+// Look up the page of a remote search beginning at start, query being
+// normalised already. The ordered results are appended to hits, a
+// GArray of DbSearchHit. next_start receives the start of the following
+// page, -1 after the last one, and fresh whether the page is younger
+// than its TTL.
+// Returns SQLITE_ROW if the page was found, SQLITE_DONE if not
+int db_search_cache_get(
+    sqlite3 *db, char const *query, char const *entry_type, size_t start,
+    GArray *hits, gint64 *next_start, bool *fresh
+);
+// Remember a page for max_age seconds, pages which expired longer than
+// max_age ago are dropped
+int db_search_cache_put(
+    sqlite3 *db, char const *query, char const *entry_type, size_t start,
+    DbSearchHit const *hits, gsize n, gint64 next_start, gint64 max_age
+);
+// Append a new VocagtkEntry for every hit which is stored to out, in order
+int db_entry_get_hits(
+    sqlite3 *db, DbSearchHit const *hits, gsize n, GPtrArray *out
+);
 
 // Playlist operations
 // Returns: number of playlists created (1 if newly created, 0 if already exists)
@@ -5,30 +5,138 @@
 #include <gio/gio.h>
 #include <glib.h>
 #include <sqlite3.h>
+#include <stdbool.h>
 #include <yyjson.h>
 
+#include "httpcache.h"
+#include "imagecache.h"
+#include "ratelimit.h"
+
 #define VOCAGTK_DOWNLOADER_PAGE_SIZE (0x20)
+// Bounds of adaptive page sizes, VocaDB caps maxResults at 100
+#define VOCAGTK_DOWNLOADER_PAGE_MIN (8)
+#define VOCAGTK_DOWNLOADER_PAGE_MAX (100)
+// Pages a backfill downloads ahead of the consumer
+#define VOCAGTK_DOWNLOADER_PAGE_WINDOW (4)
+// Transfers a batch keeps running at once
+#define VOCAGTK_DOWNLOADER_MAX_IN_FLIGHT (8)
+// How long responses are served from the HTTP cache, in seconds
+#define VOCAGTK_DOWNLOADER_ENTRY_TTL (24 * 60 * 60)
+#define VOCAGTK_DOWNLOADER_SEARCH_TTL (10 * 60)
+
+// Every counter is updated atomically from any thread. Read the gint ones
+// with g_atomic_int_get, the gsize ones with g_atomic_pointer_get.
+typedef struct {
+    gint transfers; // finished transfers, including failed ones
+    gint conn_new; // transfers which had to open a new connection
+    gint conn_reused; // transfers served by an already open connection
+    gint retries; // attempts repeated after a transient failure
+    gint pages; // result pages requested
+    gint pages_fixed; // what pages of VOCAGTK_DOWNLOADER_PAGE_SIZE would take
+    gsize wire_bytes; // body bytes as received
+    gsize decoded_bytes; // the same after content decoding
+} VocagtkDownloaderStats;
+
+// Overridden by the environment variables of the same name, e.g. to talk
+// to the stand-in server of test/standin.c
+#define VOCAGTK_API_BASE "https://vocadb.net"
+// Images are then fetched from VOCAGTK_IMAGE_BASE/<host>/<path>
+#define VOCAGTK_IMAGE_BASE NULL
+
+// What adaptive page sizing learned from previous pages, main thread only.
+// Averages are exponentially weighted.
+typedef struct {
+    double new_items; // songs an incremental update went through
+    double bytes_per_item; // on the wire
+    double first_byte_us; // per request overhead
+    double bytes_per_us; // throughput once the body flows
+} VocagtkPaging;
 
 typedef struct {
-    CURL *handle;
     char const *cache_path;
+    char *api_base; // API URLs starting with '/' are relative to it
+    char *image_base; // NULL to fetch images from their own host
+    CURLM *multi; // drives every asynchronous transfer
+    GSource *source; // dispatches multi on the main context
+    CURLSH *share; // DNS, connection and TLS session cache of all handles
+    GMutex share_locks[CURL_LOCK_DATA_LAST];
+    GPtrArray *idle; // easy handles ready for reuse
+    GMutex lock; // protects idle
+    VocagtkDownloaderStats stats;
+    VocagtkPaging paging;
+    VocagtkHttpCache http_cache; // stored in cache_path
+    VocagtkImageCache image_cache; // stored in cache_path/images
+    VocagtkRateLimiter limiter; // paces requests to the VocaDB API
+    GQueue waiting; // rate limited transfers not started yet
+    guint admit_id; // timeout source starting them
+    GHashTable *flights; // URL or file path -> request shared by callers
 } VocagtkDownloader;
 
+#define VOCAGTK_DOWNLOADER_ERROR (vocagtk_downloader_error_quark())
+GQuark vocagtk_downloader_error_quark(void);
+
+typedef enum {
+    VOCAGTK_DOWNLOADER_ERROR_NETWORK, // curl failed, see the message
+    VOCAGTK_DOWNLOADER_ERROR_PARSE, // the body is not valid JSON
+} VocagtkDownloaderError;
+
 typedef struct {
     char const *query;
     char const *entry_type; // -1 means anything, or follow VocagtkEntryTypeLabel
+    size_t start; // offset of the first result wanted
 } VocagtkSearchQuery;
 
+typedef struct _VocagtkPageFetch VocagtkPageFetch;
+
 typedef struct {
-    yyjson_doc *doc;
-    yyjson_arr_iter iter;
+    yyjson_doc *doc; // last complete page, with its items removed
+    yyjson_doc *item; // backs the value last returned by next
+    GQueue pages; // VocagtkPageFetch *, in order, the head is being consumed
+    GTask *pending; // next_async call waiting for an item
+    guint pump_id; // idle source completing pending
+    VocagtkDownloader *dl;
     GString *url;
     size_t start; // begin with 0
-    size_t page_size;
-    size_t start_offset_in_url;
+    size_t next_start; // start of the next page to request
+    size_t item_page; // start of the page the last item came from
+    size_t page_size; // maxResults of the last page requested
+    gint64 total; // number of results, -1 until known
+    bool ended; // no page after next_start is needed
+    guint pages_requested;
+    size_t start_offset_in_url; // where start and maxResults are appended
     time_t last_update_at;
+    gint64 max_age; // pages are served from the HTTP cache if > 0
+    GCancellable *cancellable; // aborts the pages being downloaded
+    gint64 deadline; // of every page request, 0 for the default
 } VocagtkResultIterator;
 
+// Initialize the downloader and hook it into the default main context.
+// Returns false if curl could not be initialized.
+bool vocagtk_downloader_init(VocagtkDownloader *dl, char const *cache_path);
+void vocagtk_downloader_clear(VocagtkDownloader *dl);
+
+// Every request can be aborted with a cancellable, which may be NULL, and
+// given a deadline in g_get_monotonic_time() µs, 0 for the default.
+
+// Fetch and parse a JSON document, blocking the calling thread. A url
+// starting with '/' is relative to the API base.
+// Returns NULL on network/parse error or once cancelled.
+yyjson_doc *vocagtk_downloader_json(
+    VocagtkDownloader *dl, char const *url,
+    GCancellable *cancellable, gint64 deadline
+);
+
+// Same as vocagtk_downloader_json but runs on the multi handle,
+// callback is invoked on the main context. Concurrent calls for the same
+// URL share a single request, which is aborted once all of them cancelled.
+void vocagtk_downloader_json_async(
+    VocagtkDownloader *dl, char const *url,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+);
+// Returns a document owned by the caller, or NULL with error set.
+yyjson_doc *vocagtk_downloader_json_finish(GAsyncResult *res, GError **error);
+
 void vocagtk_downloader_search(
     VocagtkSearchQuery const *query, // in
     VocagtkResultIterator *iter // out
@@ -39,23 +147,94 @@ void vocagtk_downloader_update(
     VocagtkResultIterator *iter // out
 );
 
+// Continue an update which stored its first start results already. Only
+// songs published before before are asked for, which keeps the offsets of
+// the interrupted update valid when new songs were published meanwhile.
+void vocagtk_downloader_update_resume(
+    int artist_id, time_t last_update_at,
+    time_t before, size_t start,
+    VocagtkResultIterator *iter // out
+);
+
 // Fetch a single entry JSON document from VocaDB.
 // Returns NULL on network/parse error.
-yyjson_doc *vocagtk_downloader_album(VocagtkDownloader *dl, int id);
-yyjson_doc *vocagtk_downloader_artist(VocagtkDownloader *dl, int id);
-yyjson_doc *vocagtk_downloader_song(VocagtkDownloader *dl, int id);
+yyjson_doc *vocagtk_downloader_album(
+    VocagtkDownloader *dl, int id,
+    GCancellable *cancellable, gint64 deadline
+);
+yyjson_doc *vocagtk_downloader_artist(
+    VocagtkDownloader *dl, int id,
+    GCancellable *cancellable, gint64 deadline
+);
+yyjson_doc *vocagtk_downloader_song(
+    VocagtkDownloader *dl, int id,
+    GCancellable *cancellable, gint64 deadline
+);
 
-yyjson_val *vocagtk_result_iterator_next(
+// Fetch many entries concurrently on the multi handle, VocaDB is asked
+// for VOCAGTK_DOWNLOADER_MAX_IN_FLIGHT of them at a time. Finish any of
+// them with vocagtk_downloader_batch_finish, which returns an array of
+// yyjson_doc * in the order of ids, NULL where an entry could not be
+// fetched. The array frees its documents.
+void vocagtk_downloader_albums_async(
+    VocagtkDownloader *dl, int const *ids, gsize n,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+);
+void vocagtk_downloader_artists_async(
+    VocagtkDownloader *dl, int const *ids, gsize n,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+);
+void vocagtk_downloader_songs_async(
+    VocagtkDownloader *dl, int const *ids, gsize n,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+);
+GPtrArray *vocagtk_downloader_batch_finish(GAsyncResult *res, GError **error);
+
+// Abort the requests of iter with cancellable, pages already requested
+// included, and give each new one the deadline. Clearing the iterator drops
+// the cancellable.
+void vocagtk_result_iterator_set_cancellable(
     VocagtkResultIterator *iter,
-    VocagtkDownloader *dl, CURLcode *err
+    GCancellable *cancellable, gint64 deadline
+);
+
+// Completes as soon as the next item has arrived, items are parsed one by
+// one while their page is still downloading. The following page is
+// requested while the current one is consumed. Full backfills of an artist
+// fetch up to VOCAGTK_DOWNLOADER_PAGE_WINDOW pages at once, items are still
+// returned in order. Searches request their next page only once the
+// previous one was consumed.
+// Only one call may be pending on an iterator at a time. A non-NULL
+// cancellable replaces the one of the iterator, pages already requested
+// are aborted by it from then on.
+// The returned value stays valid until the next call on iter.
+void vocagtk_result_iterator_next_async(
+    VocagtkResultIterator *iter, VocagtkDownloader *dl,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
 );
+// Returns NULL with error unset once the iterator is exhausted, the
+// iterator is cleared in that case and after an error.
+yyjson_val *vocagtk_result_iterator_next_finish(
+    VocagtkResultIterator *iter,
+    GAsyncResult *res, GError **error
+);
+
+// Release an iterator which was not run until exhaustion.
+// A pending next_async call fails with G_IO_ERROR_CANCELLED.
+void vocagtk_result_iterator_clear(VocagtkResultIterator *iter);
 
-// Download image from URL and save to specified path.
-// Returns CURLE_OK on success.
-CURLcode vocagtk_downloader_image(
-    VocagtkDownloader *dl,
-    char const *url,
-    char const *out_path
+// Download the image at url into the image cache unless it is indexed
+// already, its file is then at vocagtk_image_cache_path.
+// Concurrent calls for the same url share a single download.
+void vocagtk_downloader_image_async(
+    VocagtkDownloader *dl, char const *url,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
 );
+bool vocagtk_downloader_image_finish(GAsyncResult *res, GError **error);
 
 #endif
@@ -37,6 +37,7 @@ typedef struct _VocagtkEntryBox {
     EntryListCtx *list; // managed by entry list, doesn't take reference count
     VocagtkEntry *entry; // A reference to the entry bound to this box, but doesn't take reference count
     GtkListItem *item; // doesn't take reference count
+    GCancellable *image_cancellable; // aborts the image download of the last bind
 } VocagtkEntryBox;
 
 G_END_DECLS
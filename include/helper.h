@@ -11,6 +11,8 @@
 #include "exterr.h"
 #include "dl.h"
 
+typedef struct _SearchRun SearchRun;
+
 typedef struct {
     VocagtkDownloader dl; // before app activates
     sqlite3 *db; // before app activates
@@ -18,9 +20,19 @@ typedef struct {
         GtkEntry *field;
         GtkDropDown *type_selector;
         GListStore *list;
+        SearchRun *run; // latest query, NULL before the first one
+        guint debounce_id; // timeout searching once typing paused
     } search_widgets; // on build search
     GListStore *rss_artist; // on build rss
     GListStore *rss_song; // on build rss
+    GtkProgressBar *rss_progress; // on build rss
+    GCancellable *rss_sync; // update of artists, NULL if none runs
+    GArray *rss_queued; // int ids of artists waiting for it, may be NULL
+    struct {
+        guint source_id;
+        double credit; // artists which may be polled right now
+        gint64 last_tick; // monotonic time in µs
+    } rss_poll; // on build rss
     GtkStringList *playlists; // before app activates
     GtkDropDown *playlist_select; // on build playlist
     GListStore *current_playlist; // on build playlist
@@ -0,0 +1,64 @@
+#ifndef _VOCAGTK_HTTP_CACHE_H
+#define _VOCAGTK_HTTP_CACHE_H
+
+#include <glib.h>
+#include <sqlite3.h>
+#include <stdbool.h>
+
+// Size cap of the downloader's cache, overridden by the environment
+// variable of the same name in bytes
+#define VOCAGTK_HTTP_CACHE_MAX_BYTES (0x2000000) // 32 MiB
+
+// On-disk response cache keyed by the full request URL.
+// Only used from the main thread.
+typedef struct {
+    sqlite3 *db; // NULL if the cache is disabled
+    gint64 max_bytes; // least recently used entries are evicted above this
+    gint64 total_bytes;
+    guint hits; // served without network
+    guint revalidated; // answered by 304 Not Modified
+    guint misses; // not cached or stale
+} VocagtkHttpCache;
+
+typedef struct {
+    GBytes *body;
+    char *etag; // may be NULL
+    char *last_modified; // may be NULL
+    bool fresh; // false means it must be revalidated before use
+} VocagtkHttpCacheEntry;
+
+// Open or create the cache database at path.
+// On failure the cache stays disabled and every lookup misses.
+bool vocagtk_http_cache_open(
+    VocagtkHttpCache *cache,
+    char const *path, gint64 max_bytes
+);
+void vocagtk_http_cache_close(VocagtkHttpCache *cache);
+
+// Change the size cap, evicting right away if the cache is over it.
+void vocagtk_http_cache_set_max_bytes(
+    VocagtkHttpCache *cache, gint64 max_bytes
+);
+
+// Returns NULL if url is not cached, or a new entry owned by the caller.
+// A hit counts as an access for LRU eviction.
+VocagtkHttpCacheEntry *vocagtk_http_cache_lookup(
+    VocagtkHttpCache *cache, char const *url
+);
+void vocagtk_http_cache_entry_free(VocagtkHttpCacheEntry *entry);
+
+// Insert or replace the response of url, it stays fresh for max_age seconds.
+void vocagtk_http_cache_store(
+    VocagtkHttpCache *cache, char const *url,
+    guint8 const *body, gsize len,
+    char const *etag, char const *last_modified,
+    gint64 max_age
+);
+
+// Mark a revalidated entry fresh for another max_age seconds.
+void vocagtk_http_cache_refresh(
+    VocagtkHttpCache *cache, char const *url,
+    gint64 max_age
+);
+
+#endif
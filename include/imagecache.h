@@ -0,0 +1,80 @@
+#ifndef _VOCAGTK_IMAGE_CACHE_H
+#define _VOCAGTK_IMAGE_CACHE_H
+
+#include <glib.h>
+#include <sqlite3.h>
+#include <stdbool.h>
+
+#define VOCAGTK_IMAGE_CACHE_MAX_BYTES (0x20000000) // 512 MiB
+// Seconds between writes of the access times gathered meanwhile
+#define VOCAGTK_IMAGE_CACHE_FLUSH (10)
+// Images dropped per idle dispatch of the evictor
+#define VOCAGTK_IMAGE_CACHE_EVICT_BATCH (256)
+
+// Called on a worker thread with the key of every image evicted, once its
+// files are gone
+typedef void (*VocagtkImageEvictFunc)(char const *key, gpointer user_data);
+
+// On-disk image cache. Files are named by the SHA-256 of their full URL
+// and sharded as dir/ab/cd/<hash>, an SQLite index next to them keeps their
+// sizes and access times. Paths can be computed from any thread, everything
+// else is only used from the main thread.
+typedef struct {
+    sqlite3 *db; // NULL if the index is disabled
+    char *dir;
+    gint64 max_bytes; // least recently used images are evicted above this
+    gint64 total_bytes;
+    GHashTable *touched; // hashes accessed since the last flush
+    GHashTable *busy; // hashes being downloaded -> count, shared with eviction
+    guint flush_id; // timeout source writing touched
+    guint evict_id; // idle source evicting down to max_bytes
+    VocagtkImageEvictFunc evict_func; // may be NULL
+    gpointer evict_data;
+    guint hits;
+    guint misses;
+    guint evicted;
+} VocagtkImageCache;
+
+// Open or create the cache in dir, evicting in the background if it is
+// over max_bytes. On failure the index stays disabled and the cache falls
+// back to checking for the files themselves.
+bool vocagtk_image_cache_open(
+    VocagtkImageCache *cache,
+    char const *dir, gint64 max_bytes
+);
+void vocagtk_image_cache_close(VocagtkImageCache *cache);
+
+// Change the size cap, evicting in the background if the cache is over it.
+void vocagtk_image_cache_set_max_bytes(
+    VocagtkImageCache *cache, gint64 max_bytes
+);
+
+// The SHA-256 of url in hex, owned by the caller. Names its files.
+char *vocagtk_image_cache_key(char const *url);
+
+// Where the image at url is stored, owned by the caller. Variants derived
+// from it may be stored under the same path followed by a suffix.
+char *vocagtk_image_cache_path(VocagtkImageCache const *cache, char const *url);
+
+// Returns true if the image at url is indexed. A hit counts as an access.
+bool vocagtk_image_cache_contains(VocagtkImageCache *cache, char const *url);
+
+// Record an access of url for LRU eviction, written in batches.
+void vocagtk_image_cache_touch(VocagtkImageCache *cache, char const *url);
+
+// Index the image of bytes just stored at the path of url.
+void vocagtk_image_cache_add(
+    VocagtkImageCache *cache, char const *url, gint64 bytes
+);
+// Account for a variant of bytes stored next to the image of url.
+void vocagtk_image_cache_grow(
+    VocagtkImageCache *cache, char const *url, gint64 bytes
+);
+// Mark url as being downloaded until released, eviction leaves its files
+// alone meanwhile. Blocks while eviction is removing them.
+void vocagtk_image_cache_hold(VocagtkImageCache *cache, char const *url);
+void vocagtk_image_cache_release(VocagtkImageCache *cache, char const *url);
+// Drop url from the index, e.g. once its file turned out to be gone.
+void vocagtk_image_cache_forget(VocagtkImageCache *cache, char const *url);
+
+#endif
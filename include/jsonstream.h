@@ -0,0 +1,41 @@
+#ifndef _VOCAGTK_JSON_STREAM_H
+#define _VOCAGTK_JSON_STREAM_H
+
+#include <glib.h>
+#include <stdbool.h>
+#include <yyjson.h>
+
+// Splits a VocaDB result page ({"items": [...], ...}) while it is being
+// downloaded. Every element of the top level "items" array is parsed on its
+// own as soon as its closing bracket arrives, everything else is kept as the
+// envelope, which becomes {"items": [], ...} once the page is complete.
+typedef struct {
+    GByteArray *envelope; // the page without the elements of items
+    GByteArray *elem; // the element being received
+    GQueue items; // yyjson_doc * of complete elements, in order
+    GString *key; // last string seen at depth 1
+    int depth;
+    int items_depth; // depth inside the items array, 0 outside of it
+    bool in_string;
+    bool escape;
+    size_t received; // bytes fed so far
+    size_t n_items; // elements completed so far, malformed ones included
+} VocagtkJsonStream;
+
+void vocagtk_json_stream_init(VocagtkJsonStream *stream);
+void vocagtk_json_stream_clear(VocagtkJsonStream *stream);
+
+void vocagtk_json_stream_feed(
+    VocagtkJsonStream *stream,
+    char const *data, size_t len
+);
+
+// Returns the next complete element owned by the caller, or NULL if none
+// has been received yet.
+yyjson_doc *vocagtk_json_stream_pop(VocagtkJsonStream *stream);
+
+// Parse the envelope once the whole page was fed.
+// Returns NULL if the page is not valid JSON.
+yyjson_doc *vocagtk_json_stream_envelope(VocagtkJsonStream *stream);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _VOCAGTK_PACK_H
+#define _VOCAGTK_PACK_H
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Dead bytes a pack holds at least before it is compacted, and only once
+// they outweigh the live ones
+#define VOCAGTK_PACK_COMPACT_MIN (0x400000) // 4 MiB
+
+// Blobs keyed by an image key and a size, appended to a single data file
+// which is memory-mapped for reads. An index file next to it lists where
+// each blob starts, a blob only counts once its index record is written.
+// Replaced and removed blobs stay in the data file until a compaction
+// rewrites it on a worker thread. Safe to use from any thread, a zeroed or
+// closed pack can be opened.
+typedef struct {
+    GMutex lock;
+    GCond compacted;
+    char *data_path;
+    char *index_path;
+    int data_fd; // -1 if the pack is closed
+    FILE *index; // appended to
+    guint64 data_end;
+    guint64 live_bytes;
+    GMappedFile *map; // of the data file, remapped once it grew past it
+    GHashTable *entries; // key -> GArray of blobs stored for it
+    bool compacting;
+} VocagtkPack;
+
+// Open or create the pack named name in dir.
+bool vocagtk_pack_open(VocagtkPack *pack, char const *dir, char const *name);
+// Waits for a running compaction. Slices handed out stay valid.
+void vocagtk_pack_close(VocagtkPack *pack);
+
+// Returns a slice of the mapped data file owned by the caller, without
+// copying, or NULL if nothing is stored for key at size.
+GBytes *vocagtk_pack_lookup(VocagtkPack *pack, char const *key, int size);
+
+// Append data for key at size, replacing what was stored for it.
+bool vocagtk_pack_store(
+    VocagtkPack *pack, char const *key, int size,
+    void const *data, gsize len
+);
+
+// Drop every size stored for key.
+void vocagtk_pack_remove(VocagtkPack *pack, char const *key);
+
+#endif
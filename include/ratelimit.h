@@ -0,0 +1,50 @@
+#ifndef _VOCAGTK_RATE_LIMIT_H
+#define _VOCAGTK_RATE_LIMIT_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+// Requests per second the bucket starts with and may adapt between
+#define VOCAGTK_RATE_INITIAL (4.0)
+#define VOCAGTK_RATE_MIN (0.5)
+#define VOCAGTK_RATE_MAX (20.0)
+#define VOCAGTK_RATE_BURST (8.0)
+// Concurrent requests the window starts with and may grow to
+#define VOCAGTK_RATE_WINDOW_INITIAL (4.0)
+#define VOCAGTK_RATE_WINDOW_MAX (16.0)
+
+// Token bucket pacing request starts, plus an AIMD window bounding the
+// requests in flight. Both grow additively while the server keeps up and
+// are halved when it throttles. Only used from the main thread.
+typedef struct {
+    double rate; // tokens per second
+    double tokens;
+    gint64 refilled_at; // monotonic time in µs
+    gint64 blocked_until; // set by Retry-After
+    gint64 decreased_at; // throttles of the same window count once
+    double window;
+    guint in_flight;
+    guint throttled; // times the server pushed back
+} VocagtkRateLimiter;
+
+typedef enum {
+    VOCAGTK_RATE_OK, // answered, grow
+    VOCAGTK_RATE_THROTTLED, // 429 or 503, shrink
+    VOCAGTK_RATE_FAILED, // tells nothing about the server's limit
+} VocagtkRateFeedback;
+
+void vocagtk_rate_limiter_init(VocagtkRateLimiter *rl);
+
+// Take a token, and a slot of the window if windowed.
+// Returns 0 on success, otherwise the µs to wait before trying again,
+// or -1 if the window is full and only a release frees a slot.
+gint64 vocagtk_rate_limiter_acquire(VocagtkRateLimiter *rl, bool windowed);
+
+// Report the outcome of an acquired request.
+// retry_after is in seconds, 0 if the server didn't send one.
+void vocagtk_rate_limiter_release(
+    VocagtkRateLimiter *rl, bool windowed,
+    VocagtkRateFeedback feedback, gint64 retry_after
+);
+
+#endif
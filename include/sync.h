@@ -0,0 +1,114 @@
+#ifndef _VOCAGTK_SYNC_H
+#define _VOCAGTK_SYNC_H
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <yyjson.h>
+
+#include "artist.h"
+#include "db.h"
+#include "dl.h"
+
+// Artists updated at once by vocagtk_sync_artists_async
+#define VOCAGTK_SYNC_WORKERS (4)
+
+// Background polling checks for due artists every TICK seconds and asks
+// for at most BUDGET of them per hour. Each artist is polled PER_GAP times
+// per gap between its recent releases, learned from its newest SAMPLES
+// songs, but no more often than MIN and at least every MAX seconds.
+#define VOCAGTK_POLL_TICK (5 * 60)
+#define VOCAGTK_POLL_BUDGET (60)
+#define VOCAGTK_POLL_PER_GAP (4)
+#define VOCAGTK_POLL_SAMPLES (10)
+#define VOCAGTK_POLL_MIN (30 * 60)
+#define VOCAGTK_POLL_MAX (7 * 24 * 60 * 60)
+
+// Checkpointed update of one artist. Every page is stored together with a
+// checkpoint, an interrupted update continues after the last page it stored.
+// Songs are held back until their page is complete, a page which failed
+// halfway leaves nothing behind, even in a transaction shared with others.
+typedef struct {
+    sqlite3 *db;
+    VocagtkArtist *artist; // doesn't take ownership
+    DbSyncCheckpoint cp;
+    size_t page; // start of the page being stored
+    bool resumed; // skipping the song stored right before an interruption
+    bool own_transaction; // commits every page itself
+    size_t songs; // stored so far
+    size_t skipped; // stored for another artist of the same run already
+    GHashTable *seen; // song ids stored by the run, NULL outside of one
+    yyjson_mut_doc *held; // array of the songs of the page, NULL if none
+    bool broken; // a page failed to be stored, the update can't finish
+    bool known; // every song of the last page was stored by the run already
+} VocagtkSyncArtist;
+
+// Prepare the update of artist and its iterator. With own_transaction every
+// page is committed on its own, otherwise the caller holds a transaction
+// around every item and end, and every page goes into a savepoint of it.
+void vocagtk_sync_artist_begin(
+    VocagtkSyncArtist *sa, sqlite3 *db, VocagtkArtist *artist,
+    bool own_transaction,
+    VocagtkResultIterator *iter // out
+);
+// Take one song returned by iter, it is stored along with its page.
+// Songs in sa->seen are skipped, the ones stored are added to it.
+// Returns false once the rest of iter is not needed, because a page failed
+// to be stored or every song of a page was in sa->seen. Clear iter and
+// end the update then.
+bool vocagtk_sync_artist_item(
+    VocagtkSyncArtist *sa, VocagtkResultIterator const *iter,
+    yyjson_val *song_json
+);
+// Finish once iter is exhausted, ok tells if every page arrived. The artist
+// counts as polled either way.
+// Returns true if the update mark of the artist moved or didn't need to.
+bool vocagtk_sync_artist_end(VocagtkSyncArtist *sa, bool ok);
+
+typedef enum {
+    VOCAGTK_SYNC_RUNNING,
+    VOCAGTK_SYNC_DONE,
+    VOCAGTK_SYNC_FAILED,
+} VocagtkSyncState;
+
+// Where a run stands, reported for one artist whenever it changed
+typedef struct {
+    VocagtkArtist *artist;
+    VocagtkSyncState state;
+    size_t songs; // stored for artist so far
+    GError const *error; // why artist failed, may be NULL
+    guint finished; // artists done, failed ones included
+    guint failed;
+    guint total;
+} VocagtkSyncProgress;
+
+typedef void (*VocagtkSyncProgressFunc)(
+    VocagtkSyncProgress const *progress, gpointer user_data
+);
+
+// Update artists, an array of VocagtkArtist *, with up to workers of them
+// running at once on the multi handle. A song shared by several of them is
+// only written for the first one. Their writes share one transaction
+// which is committed whenever the main loop goes idle. progress is invoked
+// on the main context as songs arrive and artists finish, callback once
+// every artist finished.
+void vocagtk_sync_artists_async(
+    VocagtkDownloader *dl, sqlite3 *db,
+    GPtrArray *artists, guint workers,
+    VocagtkSyncProgressFunc progress, gpointer progress_data,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+);
+// Returns the number of artists which failed, or -1 with error set once
+// the run was cancelled.
+gssize vocagtk_sync_artists_finish(GAsyncResult *res, GError **error);
+
+// Seconds between two polls of the artist described by cadence.
+time_t vocagtk_sync_poll_interval(DbPollCadence const *cadence, time_t now);
+
+// Returns the ids of the subscribed artists due for a poll at now, the most
+// overdue first, at most max of them.
+GArray *vocagtk_sync_due(sqlite3 *db, time_t now, guint max);
+
+#endif
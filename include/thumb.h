@@ -0,0 +1,56 @@
+#ifndef _VOCAGTK_THUMB_H
+#define _VOCAGTK_THUMB_H
+
+#include <gdk/gdk.h>
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "dl.h"
+
+// Threads decoding cached images, shared by every list
+#define VOCAGTK_THUMB_WORKERS (2)
+// Decoded textures kept in memory, in bytes of pixels
+#define VOCAGTK_THUMB_CACHE_MAX_BYTES (0x4000000) // 64 MiB
+
+typedef struct {
+    guint hits;
+    guint misses;
+    guint evictions;
+    gint64 bytes; // held right now
+    gint64 max_bytes;
+} VocagtkThumbStats;
+
+// Every texture loaded is kept in a process-wide cache keyed by its URL
+// and size, least recently used ones are dropped above the budget.
+void vocagtk_thumb_cache_set_max_bytes(gint64 max_bytes);
+void vocagtk_thumb_cache_get_stats(VocagtkThumbStats *stats);
+// Drop every texture and log the counters
+void vocagtk_thumb_cache_clear(void);
+
+// Keep thumbnails in a single pack file next to the image cache instead of
+// a file each, they are then decoded straight from its mapping. Thumbnails
+// already stored as files are still used. Close before dl is cleared.
+bool vocagtk_thumb_pack_open(VocagtkDownloader *dl);
+void vocagtk_thumb_pack_close(VocagtkDownloader *dl);
+
+// Returns a new reference to the texture cached for url at size, NULL on
+// a miss.
+GdkTexture *vocagtk_thumb_lookup(char const *url, int size);
+
+// Load the image at url as a texture fitting size px, meant for misses of
+// vocagtk_thumb_lookup. The first load scales the original down once and
+// stores the thumbnail next to it as PNG, later ones only decode that.
+// A size of 0 loads the original as it is. Files are read and decoded on
+// a worker thread, an image which isn't cached yet is downloaded on the
+// main context first. callback is invoked on the main context, once
+// cancellable is cancelled the load fails with G_IO_ERROR_CANCELLED as soon
+// as it reaches the next step.
+void vocagtk_thumb_load_async(
+    VocagtkDownloader *dl, char const *url, int size,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+);
+// Returns a texture owned by the caller, or NULL with error set.
+GdkTexture *vocagtk_thumb_load_finish(GAsyncResult *res, GError **error);
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef _VOCAGTK_TRANSFER_H
+#define _VOCAGTK_TRANSFER_H
+
+#include <curl/curl.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "dl.h"
+#include "httpcache.h"
+
+// Every transfer gives up after this many seconds, retries included
+#define VOCAGTK_TRANSFER_DEADLINE (60)
+#define VOCAGTK_TRANSFER_CONNECT_TIMEOUT (10)
+#define VOCAGTK_TRANSFER_MAX_ATTEMPTS (5)
+// Backoff before the n-th retry is about BASE * 2^(n - 1) µs, up to MAX
+#define VOCAGTK_TRANSFER_BACKOFF_BASE (500 * 1000)
+#define VOCAGTK_TRANSFER_BACKOFF_MAX (30 * G_USEC_PER_SEC)
+
+typedef struct _VocagtkTransfer VocagtkTransfer;
+
+// Invoked exactly once on the main context when an asynchronous transfer
+// finished or failed. The transfer is freed right after it returns.
+typedef void (*VocagtkTransferFunc)(
+    VocagtkTransfer *xfer, CURLcode rcode, gpointer user_data
+);
+
+// Receives the body chunk by chunk while it is downloaded.
+typedef void (*VocagtkTransferSink)(
+    VocagtkTransfer *xfer, char const *data, size_t len,
+    gpointer user_data
+);
+
+typedef struct _VocagtkTransfer {
+    VocagtkDownloader *dl; // doesn't take ownership
+    CURL *handle;
+    GString *url;
+    GByteArray *body; // response body, unused when file is set
+    FILE *file; // response sink, doesn't take ownership
+    long status; // HTTP status, 0 until the transfer is done
+    struct curl_slist *headers; // extra request headers
+
+    gint64 max_age; // > 0 enables the HTTP cache
+    bool from_cache; // answered without touching the network
+    VocagtkHttpCacheEntry *stale; // cached response being revalidated
+    char *etag; // validators of the response
+    char *last_modified;
+    bool no_store;
+
+    VocagtkTransferSink sink;
+    gpointer sink_data;
+    size_t streamed; // bytes handed to sink by the network
+
+    gint64 wire_bytes; // body bytes received, summed over attempts
+    gint64 decoded_bytes; // the same after content decoding
+
+    bool limited; // paced by the downloader's rate limiter
+    bool holds_slot; // counted in the rate limiter's window
+    guint attempts;
+    gint64 deadline; // monotonic time in µs, 0 until the first attempt
+    gint64 not_before; // monotonic time of the next attempt
+    gint64 retry_after; // seconds, from the last response
+
+    GCancellable *cancellable; // aborts the transfer once cancelled
+    gulong cancel_id; // handler connected to cancellable
+    gint aborting; // set atomically by the first cancellation
+    GSource *abort_source; // idle source tearing the transfer down
+    guint retry_id; // timeout source of the next attempt
+    bool queued; // waiting for the rate limiter
+    bool running; // on the multi handle
+
+    VocagtkTransferFunc func;
+    gpointer user_data;
+} VocagtkTransfer;
+
+// Create the curl multi handle and attach its GSource to the default
+// main context. Returns false if curl could not be initialized.
+bool vocagtk_engine_init(VocagtkDownloader *dl);
+void vocagtk_engine_clear(VocagtkDownloader *dl);
+
+// Create a transfer which buffers the body of url into xfer->body.
+// The easy handle is borrowed from the downloader's idle pool.
+VocagtkTransfer *vocagtk_transfer_new(VocagtkDownloader *dl, char const *url);
+
+// Write the body into f instead of xfer->body.
+void vocagtk_transfer_set_file(VocagtkTransfer *xfer, FILE *f);
+
+// Serve the body from the HTTP cache while it is younger than max_age
+// seconds and revalidate it with a conditional request afterwards.
+// Only for transfers buffering into xfer->body.
+void vocagtk_transfer_set_max_age(VocagtkTransfer *xfer, gint64 max_age);
+
+// Stream the body into sink instead of buffering it. A body coming from
+// the HTTP cache is handed over in one piece before completion.
+void vocagtk_transfer_set_sink(
+    VocagtkTransfer *xfer,
+    VocagtkTransferSink sink, gpointer user_data
+);
+
+// Pace the transfer with the downloader's rate limiter, meant for requests
+// to the VocaDB API. Throttled answers make the limiter back off.
+void vocagtk_transfer_set_rate_limited(VocagtkTransfer *xfer);
+
+// Abort the transfer as soon as cancellable is cancelled, it then fails
+// with CURLE_ABORTED_BY_CALLBACK. Running transfers leave the multi handle
+// right away, which frees their connection for the next request.
+void vocagtk_transfer_set_cancellable(
+    VocagtkTransfer *xfer, GCancellable *cancellable
+);
+
+// Give up at deadline, in g_get_monotonic_time() µs, instead of
+// VOCAGTK_TRANSFER_DEADLINE seconds after the first attempt. 0 keeps the
+// default.
+void vocagtk_transfer_set_deadline(VocagtkTransfer *xfer, gint64 deadline);
+
+// Only needed for transfers which were never started.
+void vocagtk_transfer_free(VocagtkTransfer *xfer);
+
+// Blocking perform on the calling thread, the transfer stays owned by the
+// caller. Connections are shared with the multi handle, so only call it
+// from the main thread.
+//
+// Blocking transfers make a single attempt and never sleep, so they can't
+// stall the main loop for longer than the request itself. A rate limited
+// transfer which gets no token right away fails with
+// CURLE_OPERATION_TIMEDOUT. Pacing and retries of transient failures, HTTP
+// 429 and 5xx included, are left to vocagtk_transfer_start.
+// HTTP errors are reported as CURLE_HTTP_RETURNED_ERROR, their bodies are
+// dropped.
+CURLcode vocagtk_transfer_perform(VocagtkTransfer *xfer);
+
+// Queue the transfer on the multi handle and return immediately.
+// Ownership passes to the engine. Must be called on the main context.
+// Transient failures are retried with jittered exponential backoff until
+// the deadline, waiting on timeout sources of the main loop.
+void vocagtk_transfer_start(
+    VocagtkTransfer *xfer,
+    VocagtkTransferFunc func, gpointer user_data
+);
+
+#endif
@@ -12,6 +12,17 @@ typedef struct {
     char const *playlist_name;
 } EntryListCtx;
 
+// Search results appended at once, the next batch is loaded when the list
+// is scrolled within a screen of its end
+#define VOCAGTK_SEARCH_BATCH (VOCAGTK_DOWNLOADER_PAGE_SIZE)
+// Typing searches, stored results and VocaDB alike, once the field
+// stayed unchanged for this many ms
+#define VOCAGTK_SEARCH_DEBOUNCE (250)
+// Stored entries of each type listed before the remote results
+#define VOCAGTK_SEARCH_LOCAL_LIMIT (64)
+// Seconds a page of remote results is listed without asking again
+#define VOCAGTK_SEARCH_CACHE_TTL (60 * 60)
+
 
 
 void build_home(GtkBuilder *main, AppState *ctx);
@@ -26,10 +37,14 @@ void build_playlist(GtkBuilder *main, AppState *ctx);
 
 void call_search(AppState *ctx);
 void call_init_rss_artist(AppState *ctx);
-//void call_update_rss_song(AppState *ctx, int artist_id);
 
-void update_artist(AppState *ctx, VocagtkArtist *artist);
+// Update every subscribed artist in the background, the RSS song list is
+// refreshed once all of them are done
 void update_artists(AppState *ctx);
+// Stop polling and cancel a running update of artists, returns once it
+// unwound. Call it while the widgets are still alive, before the database
+// and the downloader are closed.
+void stop_artists(AppState *ctx);
 void refresh_rss_song(AppState *ctx);
 
 void watch_entry(VocagtkEntry *entry, EntryListCtx *list_ctx, int position);
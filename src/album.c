@@ -144,7 +144,7 @@ VocagtkAlbum *vocagtk_album_new(VocagtkAlbumId id, AppState *ctx) {
 
     if (album) return album;
 
-    yyjson_doc *doc = vocagtk_downloader_album(&ctx->dl, id);
+    yyjson_doc *doc = vocagtk_downloader_album(&ctx->dl, id, NULL, 0);
     if (!doc) {
         // Network/parse error: keep behaviour similar to other entities: return minimal object.
         return g_object_new(VOCAGTK_TYPE_ALBUM, "id", id, NULL);
@@ -166,6 +166,31 @@ VocagtkAlbum *vocagtk_album_new(VocagtkAlbumId id, AppState *ctx) {
     return album;
 }
 
+static gpointer album_from_json(yyjson_val *json) {
+    return json_to_album(json);
+}
+
+void vocagtk_album_new_many_async(
+    VocagtkAlbumId const *ids, gsize n,
+    AppState *ctx, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    static DbLoadManyFuncs const funcs = {
+        .get_by_ids = db_album_get_by_ids,
+        .fetch_async = vocagtk_downloader_albums_async,
+        .from_json = album_from_json,
+        .store = db_album_add_from_json,
+    };
+    db_load_many_async(
+        ctx->db, &ctx->dl, &funcs, (int const *) ids, n,
+        cancellable, callback, user_data
+    );
+}
+
+GPtrArray *vocagtk_album_new_many_finish(GAsyncResult *res, GError **error) {
+    return db_load_many_finish(res, error);
+}
+
 VocagtkAlbumId vocagtk_album_get_id(VocagtkAlbum *self) {
     return self->id;
 }
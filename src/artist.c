@@ -131,7 +131,7 @@ VocagtkArtist *vocagtk_artist_new(VocagtkArtistId id, AppState *ctx) {
     VocagtkArtist *artist = db_artist_get_by_id(ctx->db, id, &sql_err);
     if (artist) return artist;
 
-    yyjson_doc *doc = vocagtk_downloader_artist(&ctx->dl, id);
+    yyjson_doc *doc = vocagtk_downloader_artist(&ctx->dl, id, NULL, 0);
     if (!doc) {
         return g_object_new(VOCAGTK_TYPE_ARTIST, "id", id, NULL);
     }
@@ -152,6 +152,30 @@ VocagtkArtist *vocagtk_artist_new(VocagtkArtistId id, AppState *ctx) {
     return artist;
 }
 
+static gpointer artist_from_json(yyjson_val *json) {
+    return json_to_artist(json);
+}
+
+void vocagtk_artist_new_many_async(
+    VocagtkArtistId const *ids, gsize n,
+    AppState *ctx, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    static DbLoadManyFuncs const funcs = {
+        .get_by_ids = db_artist_get_by_ids,
+        .fetch_async = vocagtk_downloader_artists_async,
+        .from_json = artist_from_json,
+        .store = db_artist_add_from_json,
+    };
+    db_load_many_async(
+        ctx->db, &ctx->dl, &funcs, (int const *) ids, n,
+        cancellable, callback, user_data
+    );
+}
+
+GPtrArray *vocagtk_artist_new_many_finish(GAsyncResult *res, GError **error) {
+    return db_load_many_finish(res, error);
+}
 
 VocagtkArtistId vocagtk_artist_get_id(VocagtkArtist *self) {
     return self->id;
@@ -570,6 +570,29 @@ int db_insert_song_artists(sqlite3 *db, yyjson_val *song_json, int *sql_err) {
     return total;
 }
 
+int db_song_store_from_json(sqlite3 *db, yyjson_val *song_json) {
+    // 1. Insert song itself into database
+    int rcode = db_song_add_from_json(db, song_json);
+    if (rcode != SQLITE_OK) vocagtk_warn_sql_db(db);
+
+    // 2. Insert song-album relations into database
+    int sql_err = SQLITE_OK;
+    db_insert_song_albums(db, song_json, &sql_err);
+    if (sql_err != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        rcode = sql_err;
+    }
+
+    // 3. Insert song-artist relations into database
+    sql_err = SQLITE_OK;
+    db_insert_song_artists(db, song_json, &sql_err);
+    if (sql_err != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        rcode = sql_err;
+    }
+    return rcode;
+}
+
 // 向 rss 订阅添加 artist_id
 // 返回值：成功插入的行数（1=新插入，0=已存在）
 // sql_err: 如果提供，接收 SQLite 错误码
@@ -666,6 +689,92 @@ int db_entry_add(sqlite3 *db, VocagtkEntry const *entry) {
     }
 }
 
+// Entries of one table whose name contains the pattern, wrapped by type
+static int db_entry_search_table(
+    sqlite3 *db, char const *sql, char const *pattern, int limit,
+    VocagtkEntryTypeLabel type, GPtrArray *out
+) {
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+    sqlite3_bind_text(stmt, 1, pattern, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, limit);
+
+    while ((rcode = sqlite3_step(stmt)) == SQLITE_ROW) {
+        VocagtkEntry *entry = NULL;
+        switch (type) {
+        case VOCAGTK_ENTRY_TYPE_LABEL_ALBUM:
+            entry = vocagtk_entry_new_album(db_album_from_row(stmt, NULL));
+            break;
+        case VOCAGTK_ENTRY_TYPE_LABEL_ARTIST:
+            entry = vocagtk_entry_new_artist(db_artist_from_row(stmt, NULL));
+            break;
+        case VOCAGTK_ENTRY_TYPE_LABEL_SONG:
+            entry = vocagtk_entry_new_song(db_song_from_row(stmt, NULL));
+            break;
+        }
+        if (entry) g_ptr_array_add(out, entry);
+    }
+    if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(db);
+        sqlite3_finalize(stmt);
+        return rcode;
+    }
+
+    rcode = sqlite3_finalize(stmt);
+    return rcode;
+}
+
+int db_entry_search(
+    sqlite3 *db, char const *query, char const *entry_type,
+    int limit, GPtrArray *out
+) {
+    // The query is matched literally, LIKE wildcards in it are escaped
+    GString *pattern = g_string_new("%");
+    for (char const *c = query; *c; c++) {
+        if (*c == '%' || *c == '_' || *c == '\\') {
+            g_string_append_c(pattern, '\\');
+        }
+        g_string_append_c(pattern, *c);
+    }
+    g_string_append_c(pattern, '%');
+
+    bool any = !entry_type || !*entry_type;
+    int rcode = SQLITE_OK;
+    if (any || g_strcmp0(entry_type, "Artist") == 0) {
+        rcode = db_entry_search_table(
+            db,
+            "SELECT id, name, avatar_url, update_at FROM artist "
+            "WHERE name LIKE ?1 ESCAPE '\\' ORDER BY name LIMIT ?2;",
+            pattern->str, limit, VOCAGTK_ENTRY_TYPE_LABEL_ARTIST, out
+        );
+    }
+    if (rcode == SQLITE_OK && (any || g_strcmp0(entry_type, "Album") == 0)) {
+        rcode = db_entry_search_table(
+            db,
+            "SELECT id, title, artist, cover_url, publish_date FROM album "
+            "WHERE title LIKE ?1 ESCAPE '\\' "
+            "ORDER BY publish_date DESC LIMIT ?2;",
+            pattern->str, limit, VOCAGTK_ENTRY_TYPE_LABEL_ALBUM, out
+        );
+    }
+    if (rcode == SQLITE_OK && (any || g_strcmp0(entry_type, "Song") == 0)) {
+        rcode = db_entry_search_table(
+            db,
+            "SELECT id, title, artist, image_url, publish_date FROM song "
+            "WHERE title LIKE ?1 ESCAPE '\\' "
+            "ORDER BY publish_date DESC LIMIT ?2;",
+            pattern->str, limit, VOCAGTK_ENTRY_TYPE_LABEL_SONG, out
+        );
+    }
+
+    g_string_free(pattern, true);
+    return rcode;
+}
+
 // Playlist operations
 
 /**
@@ -957,3 +1066,566 @@ int db_playlist_get_songs(sqlite3 *db, char const *playlist_name, sqlite3_stmt *
     sqlite3_bind_text(*stmt, 1, playlist_name, -1, SQLITE_STATIC);
     return SQLITE_OK;
 }
+
+// batch helpers
+#define DB_BATCH_MAX (0x100) // ids bound to one statement
+
+typedef gpointer (*DbFromRowFunc)(sqlite3_stmt *stmt, int *sql_err);
+
+// Runs "<select> WHERE id IN (?, ...)" over ids, a statement per
+// DB_BATCH_MAX ids, and inserts every row found into out keyed by id.
+static int db_get_by_ids(
+    sqlite3 *db, char const *select,
+    int const *ids, gsize n,
+    DbFromRowFunc from_row, GHashTable *out
+) {
+    int rcode = SQLITE_OK;
+    GString *sql = g_string_new(NULL);
+
+    for (gsize off = 0; off < n; off += DB_BATCH_MAX) {
+        gsize len = MIN(n - off, DB_BATCH_MAX);
+
+        g_string_assign(sql, select);
+        g_string_append(sql, " WHERE id IN (?");
+        for (gsize i = 1; i < len; i++) g_string_append(sql, ", ?");
+        g_string_append(sql, ");");
+
+        sqlite3_stmt *stmt = NULL;
+        rcode = sqlite3_prepare_v2(db, sql->str, -1, &stmt, NULL);
+        if (rcode != SQLITE_OK) {
+            vocagtk_warn_sql_db(db);
+            break;
+        }
+        for (gsize i = 0; i < len; i++) {
+            sqlite3_bind_int(stmt, (int) i + 1, ids[off + i]);
+        }
+
+        while ((rcode = sqlite3_step(stmt)) == SQLITE_ROW) {
+            int id = sqlite3_column_int(stmt, 0);
+            g_hash_table_replace(
+                out, GINT_TO_POINTER(id), from_row(stmt, NULL)
+            );
+        }
+        if (rcode != SQLITE_DONE) vocagtk_warn_sql_db(db);
+        rcode = sqlite3_finalize(stmt);
+        if (rcode != SQLITE_OK) break;
+    }
+
+    DEBUG("Found %u of %zu entries in db.", g_hash_table_size(out), n);
+    g_string_free(sql, true);
+    return rcode;
+}
+
+static gpointer album_from_row(sqlite3_stmt *stmt, int *sql_err) {
+    return db_album_from_row(stmt, sql_err);
+}
+static gpointer artist_from_row(sqlite3_stmt *stmt, int *sql_err) {
+    return db_artist_from_row(stmt, sql_err);
+}
+static gpointer song_from_row(sqlite3_stmt *stmt, int *sql_err) {
+    return db_song_from_row(stmt, sql_err);
+}
+
+int db_album_get_by_ids(
+    sqlite3 *db, int const *ids, gsize n,
+    GHashTable *out
+) {
+    return db_get_by_ids(
+        db, "SELECT id, title, artist, cover_url, publish_date FROM album",
+        ids, n, album_from_row, out
+    );
+}
+
+int db_artist_get_by_ids(
+    sqlite3 *db, int const *ids, gsize n,
+    GHashTable *out
+) {
+    return db_get_by_ids(
+        db, "SELECT id, name, avatar_url, update_at FROM artist",
+        ids, n, artist_from_row, out
+    );
+}
+
+int db_song_get_by_ids(
+    sqlite3 *db, int const *ids, gsize n,
+    GHashTable *out
+) {
+    return db_get_by_ids(
+        db, "SELECT id, title, artist, image_url, publish_date FROM song",
+        ids, n, song_from_row, out
+    );
+}
+
+typedef struct {
+    sqlite3 *db;
+    DbLoadManyFuncs const *funcs;
+    GArray *ids; // int, as asked for
+    GArray *missing; // int, fetched once each
+    GHashTable *found; // id -> object
+} DbLoadMany;
+
+static void db_load_many_free(DbLoadMany *load) {
+    g_array_free(load->ids, TRUE);
+    g_array_free(load->missing, TRUE);
+    g_hash_table_unref(load->found);
+    g_free(load);
+}
+
+// Objects found for the ids, in their order
+static GPtrArray *db_load_many_collect(DbLoadMany *load) {
+    GPtrArray *objs = g_ptr_array_new_full(load->ids->len, g_object_unref);
+    for (guint i = 0; i < load->ids->len; i++) {
+        int id = g_array_index(load->ids, int, i);
+        gpointer obj = g_hash_table_lookup(load->found, GINT_TO_POINTER(id));
+        if (obj) g_ptr_array_add(objs, g_object_ref(obj));
+        else DEBUG("Entry %d could not be loaded, left out", id);
+    }
+    return objs;
+}
+
+static void db_load_many_fetched(
+    GObject *_, GAsyncResult *res,
+    gpointer user_data
+) {
+    GTask *task = user_data;
+    DbLoadMany *load = g_task_get_task_data(task);
+
+    GError *error = NULL;
+    GPtrArray *docs = vocagtk_downloader_batch_finish(res, &error);
+    if (!docs) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    // 3) Save them in one transaction.
+    db_begin(load->db);
+    for (guint i = 0; i < docs->len; i++) {
+        yyjson_doc *doc = g_ptr_array_index(docs, i);
+        if (!doc) continue;
+
+        yyjson_val *root = yyjson_doc_get_root(doc);
+        gpointer obj = load->funcs->from_json(root);
+        if (!obj) continue;
+
+        if (load->funcs->store(load->db, root) != SQLITE_OK) {
+            vocagtk_warn_sql_db(load->db);
+        }
+        g_hash_table_replace(
+            load->found,
+            GINT_TO_POINTER(g_array_index(load->missing, int, i)), obj
+        );
+    }
+    db_commit(load->db);
+    g_ptr_array_unref(docs);
+
+    g_task_return_pointer(
+        task, db_load_many_collect(load), (GDestroyNotify) g_ptr_array_unref
+    );
+    g_object_unref(task);
+}
+
+void db_load_many_async(
+    sqlite3 *db, VocagtkDownloader *dl, DbLoadManyFuncs const *funcs,
+    int const *ids, gsize n, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, db_load_many_async);
+
+    DbLoadMany *load = g_new0(DbLoadMany, 1);
+    load->db = db;
+    load->funcs = funcs;
+    load->ids = g_array_sized_new(FALSE, FALSE, sizeof(int), n);
+    g_array_append_vals(load->ids, ids, n);
+    load->missing = g_array_new(FALSE, FALSE, sizeof(int));
+    load->found = g_hash_table_new_full(
+        g_direct_hash, g_direct_equal, NULL, g_object_unref
+    );
+    g_task_set_task_data(task, load, (GDestroyNotify) db_load_many_free);
+
+    // 1) Everything already in the local DB, in a single query.
+    if (funcs->get_by_ids(db, ids, n, load->found) != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+    }
+
+    // 2) Fetch each missing id once, concurrently.
+    GHashTable *wanted = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (gsize i = 0; i < n; i++) {
+        gpointer key = GINT_TO_POINTER(ids[i]);
+        if (g_hash_table_contains(load->found, key)) continue;
+        if (!g_hash_table_add(wanted, key)) continue;
+        g_array_append_val(load->missing, ids[i]);
+    }
+    g_hash_table_unref(wanted);
+
+    if (load->missing->len == 0) {
+        g_task_return_pointer(
+            task, db_load_many_collect(load),
+            (GDestroyNotify) g_ptr_array_unref
+        );
+        g_object_unref(task);
+        return;
+    }
+    funcs->fetch_async(
+        dl, (int const *) load->missing->data, load->missing->len,
+        cancellable, 0, db_load_many_fetched, task
+    );
+}
+
+GPtrArray *db_load_many_finish(GAsyncResult *res, GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, NULL), NULL);
+    return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+int db_begin(sqlite3 *db) {
+    int rcode = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    if (rcode != SQLITE_OK) vocagtk_warn_sql_db(db);
+    return rcode;
+}
+
+int db_commit(sqlite3 *db) {
+    int rcode = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    if (rcode != SQLITE_OK) vocagtk_warn_sql_db(db);
+    return rcode;
+}
+
+int db_rollback(sqlite3 *db) {
+    int rcode = sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    if (rcode != SQLITE_OK) vocagtk_warn_sql_db(db);
+    return rcode;
+}
+
+int db_savepoint(sqlite3 *db, char const *name) {
+    char *sql = sqlite3_mprintf("SAVEPOINT \"%w\";", name);
+    int rcode = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rcode != SQLITE_OK) vocagtk_warn_sql_db(db);
+    sqlite3_free(sql);
+    return rcode;
+}
+
+int db_release(sqlite3 *db, char const *name) {
+    char *sql = sqlite3_mprintf("RELEASE \"%w\";", name);
+    int rcode = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rcode != SQLITE_OK) vocagtk_warn_sql_db(db);
+    sqlite3_free(sql);
+    return rcode;
+}
+
+int db_rollback_to(sqlite3 *db, char const *name) {
+    // The savepoint stays open after ROLLBACK TO, release it as well
+    char *sql = sqlite3_mprintf(
+        "ROLLBACK TO \"%w\"; RELEASE \"%w\";", name, name
+    );
+    int rcode = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (rcode != SQLITE_OK) vocagtk_warn_sql_db(db);
+    sqlite3_free(sql);
+    return rcode;
+}
+
+int db_sync_get(sqlite3 *db, int artist_id, DbSyncCheckpoint *cp) {
+    char const *sql =
+        "SELECT since, next_start, newest, last_song_id "
+        "FROM sync_progress WHERE artist_id = ?;";
+
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+    sqlite3_bind_int(stmt, 1, artist_id);
+
+    rcode = sqlite3_step(stmt);
+    if (rcode == SQLITE_ROW) {
+        cp->since = (time_t) sqlite3_column_int64(stmt, 0);
+        cp->next_start = (size_t) sqlite3_column_int64(stmt, 1);
+        cp->newest = (time_t) sqlite3_column_int64(stmt, 2);
+        cp->last_song_id = sqlite3_column_int(stmt, 3);
+    } else if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(db);
+    }
+
+    sqlite3_finalize(stmt);
+    return rcode;
+}
+
+int db_sync_save(sqlite3 *db, int artist_id, DbSyncCheckpoint const *cp) {
+    char const *sql =
+        "INSERT INTO sync_progress"
+        "(artist_id, since, next_start, newest, last_song_id) "
+        "VALUES(?, ?, ?, ?, ?) "
+        "ON CONFLICT(artist_id) DO UPDATE SET "
+        "since = excluded.since, "
+        "next_start = excluded.next_start, "
+        "newest = excluded.newest, "
+        "last_song_id = excluded.last_song_id;";
+
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+    sqlite3_bind_int(stmt, 1, artist_id);
+    sqlite3_bind_int64(stmt, 2, cp->since);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64) cp->next_start);
+    sqlite3_bind_int64(stmt, 4, cp->newest);
+    sqlite3_bind_int(stmt, 5, cp->last_song_id);
+
+    rcode = sqlite3_step(stmt);
+    if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(db);
+        sqlite3_finalize(stmt);
+        return rcode;
+    }
+
+    rcode = sqlite3_finalize(stmt);
+    return rcode;
+}
+
+int db_sync_clear(sqlite3 *db, int artist_id) {
+    char const *sql = "DELETE FROM sync_progress WHERE artist_id = ?;";
+
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+    sqlite3_bind_int(stmt, 1, artist_id);
+
+    rcode = sqlite3_step(stmt);
+    if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(db);
+        sqlite3_finalize(stmt);
+        return rcode;
+    }
+
+    rcode = sqlite3_finalize(stmt);
+    return rcode;
+}
+
+int db_rss_set_polled(sqlite3 *db, int artist_id, time_t polled_at) {
+    char const *sql =
+        "INSERT INTO rss_poll(artist_id, polled_at) VALUES(?, ?) "
+        "ON CONFLICT(artist_id) DO UPDATE SET polled_at = excluded.polled_at;";
+
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+    sqlite3_bind_int(stmt, 1, artist_id);
+    sqlite3_bind_int64(stmt, 2, polled_at);
+
+    rcode = sqlite3_step(stmt);
+    if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(db);
+        sqlite3_finalize(stmt);
+        return rcode;
+    }
+
+    rcode = sqlite3_finalize(stmt);
+    return rcode;
+}
+
+int db_rss_get_cadence(sqlite3 *db, int samples, GArray *out) {
+    char const *sql =
+        "SELECT r.artist_id, COALESCE(p.polled_at, 0), "
+        "COUNT(s.publish_date), MAX(s.publish_date), MIN(s.publish_date) "
+        "FROM rss r "
+        "LEFT JOIN rss_poll p ON p.artist_id = r.artist_id "
+        "LEFT JOIN ("
+        "SELECT afs.artist_id, s.publish_date, ROW_NUMBER() OVER ("
+        "PARTITION BY afs.artist_id ORDER BY s.publish_date DESC"
+        ") AS n "
+        "FROM artist_for_song afs JOIN song s ON s.id = afs.song_id "
+        "WHERE s.publish_date > 0"
+        ") s ON s.artist_id = r.artist_id AND s.n <= ? "
+        "GROUP BY r.artist_id;";
+
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+    sqlite3_bind_int(stmt, 1, samples);
+
+    while ((rcode = sqlite3_step(stmt)) == SQLITE_ROW) {
+        DbPollCadence cadence = {
+            .artist_id = sqlite3_column_int(stmt, 0),
+            .polled_at = (time_t) sqlite3_column_int64(stmt, 1),
+            .releases = sqlite3_column_int(stmt, 2),
+            .latest = (time_t) sqlite3_column_int64(stmt, 3),
+            .oldest = (time_t) sqlite3_column_int64(stmt, 4),
+        };
+        g_array_append_val(out, cadence);
+    }
+    if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(db);
+        sqlite3_finalize(stmt);
+        return rcode;
+    }
+
+    rcode = sqlite3_finalize(stmt);
+    return rcode;
+}
+
+int db_search_cache_get(
+    sqlite3 *db, char const *query, char const *entry_type, size_t start,
+    GArray *hits, gint64 *next_start, bool *fresh
+) {
+    char const *sql =
+        "SELECT hits, next_start, expires_at FROM search_cache "
+        "WHERE query = ? AND entry_type = ? AND start = ?;";
+
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+    sqlite3_bind_text(stmt, 1, query, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, entry_type, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64) start);
+
+    rcode = sqlite3_step(stmt);
+    if (rcode == SQLITE_ROW) {
+        // Hits are stored as "type:id" separated by commas
+        char const *text = sqlite3_column_str(stmt, 0);
+        char **parts = g_strsplit(text ? text : "", ",", -1);
+        for (char **part = parts; *part; part++) {
+            unsigned type;
+            int id;
+            if (sscanf(*part, "%u:%d", &type, &id) != 2) continue;
+            DbSearchHit hit = { .type = type, .id = id };
+            g_array_append_val(hits, hit);
+        }
+        g_strfreev(parts);
+        *next_start = sqlite3_column_int64(stmt, 1);
+        *fresh = sqlite3_column_int64(stmt, 2) > time(NULL);
+    } else if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(db);
+    }
+
+    sqlite3_finalize(stmt);
+    return rcode;
+}
+
+int db_search_cache_put(
+    sqlite3 *db, char const *query, char const *entry_type, size_t start,
+    DbSearchHit const *hits, gsize n, gint64 next_start, gint64 max_age
+) {
+    char const *prune = "DELETE FROM search_cache WHERE expires_at < ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(db, prune, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+    sqlite3_bind_int64(stmt, 1, time(NULL) - max_age);
+    if (sqlite3_step(stmt) != SQLITE_DONE) vocagtk_warn_sql_db(db);
+    sqlite3_finalize(stmt);
+
+    char const *sql =
+        "INSERT INTO search_cache"
+        "(query, entry_type, start, hits, next_start, expires_at) "
+        "VALUES(?, ?, ?, ?, ?, ?) "
+        "ON CONFLICT(query, entry_type, start) DO UPDATE SET "
+        "hits = excluded.hits, "
+        "next_start = excluded.next_start, "
+        "expires_at = excluded.expires_at;";
+    rcode = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(db);
+        return rcode;
+    }
+
+    GString *text = g_string_new(NULL);
+    for (gsize i = 0; i < n; i++) {
+        if (i > 0) g_string_append_c(text, ',');
+        g_string_append_printf(
+            text, "%u:%d", (unsigned) hits[i].type, hits[i].id
+        );
+    }
+
+    sqlite3_bind_text(stmt, 1, query, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, entry_type, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64) start);
+    sqlite3_bind_text(stmt, 4, text->str, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 5, next_start);
+    sqlite3_bind_int64(stmt, 6, time(NULL) + max_age);
+
+    rcode = sqlite3_step(stmt);
+    g_string_free(text, true);
+    if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(db);
+        sqlite3_finalize(stmt);
+        return rcode;
+    }
+
+    rcode = sqlite3_finalize(stmt);
+    return rcode;
+}
+
+int db_entry_get_hits(
+    sqlite3 *db, DbSearchHit const *hits, gsize n, GPtrArray *out
+) {
+    GArray *ids[3];
+    GHashTable *found[3];
+    for (int type = 0; type < 3; type++) {
+        ids[type] = g_array_new(false, false, sizeof(int));
+        found[type] = g_hash_table_new_full(
+            g_direct_hash, g_direct_equal, NULL, g_object_unref
+        );
+    }
+    for (gsize i = 0; i < n; i++) {
+        if (hits[i].type > VOCAGTK_ENTRY_TYPE_LABEL_SONG) continue;
+        g_array_append_val(ids[hits[i].type], hits[i].id);
+    }
+
+    int rcode = db_album_get_by_ids(
+        db, (int const *) ids[VOCAGTK_ENTRY_TYPE_LABEL_ALBUM]->data,
+        ids[VOCAGTK_ENTRY_TYPE_LABEL_ALBUM]->len,
+        found[VOCAGTK_ENTRY_TYPE_LABEL_ALBUM]
+    );
+    if (rcode == SQLITE_OK) rcode = db_artist_get_by_ids(
+        db, (int const *) ids[VOCAGTK_ENTRY_TYPE_LABEL_ARTIST]->data,
+        ids[VOCAGTK_ENTRY_TYPE_LABEL_ARTIST]->len,
+        found[VOCAGTK_ENTRY_TYPE_LABEL_ARTIST]
+    );
+    if (rcode == SQLITE_OK) rcode = db_song_get_by_ids(
+        db, (int const *) ids[VOCAGTK_ENTRY_TYPE_LABEL_SONG]->data,
+        ids[VOCAGTK_ENTRY_TYPE_LABEL_SONG]->len,
+        found[VOCAGTK_ENTRY_TYPE_LABEL_SONG]
+    );
+
+    for (gsize i = 0; rcode == SQLITE_OK && i < n; i++) {
+        if (hits[i].type > VOCAGTK_ENTRY_TYPE_LABEL_SONG) continue;
+        gpointer obj = NULL;
+        if (!g_hash_table_steal_extended(
+            found[hits[i].type], GINT_TO_POINTER(hits[i].id), NULL, &obj
+        )) continue;
+
+        switch (hits[i].type) {
+        case VOCAGTK_ENTRY_TYPE_LABEL_ALBUM:
+            g_ptr_array_add(out, vocagtk_entry_new_album(obj));
+            break;
+        case VOCAGTK_ENTRY_TYPE_LABEL_ARTIST:
+            g_ptr_array_add(out, vocagtk_entry_new_artist(obj));
+            break;
+        case VOCAGTK_ENTRY_TYPE_LABEL_SONG:
+            g_ptr_array_add(out, vocagtk_entry_new_song(obj));
+            break;
+        }
+    }
+
+    for (int type = 0; type < 3; type++) {
+        g_array_free(ids[type], true);
+        g_hash_table_unref(found[type]);
+    }
+    return rcode;
+}
@@ -1,5 +1,6 @@
 #include <curl/curl.h>
 #include <gdk/gdk.h>
+#include <glib/gstdio.h>
 #include <yyjson.h>
 #include <time.h>
 
@@ -7,182 +8,1116 @@
 #include "entry.h"
 #include "exterr.h"
 #include "helper.h"
+#include "jsonstream.h"
+#include "transfer.h"
 
-static inline GByteArray *download(VocagtkDownloader *dl, char const *url,
-    CURLcode *err) {
-    GByteArray *arr = g_byte_array_new();
-    curl_easy_setopt(dl->handle, CURLOPT_URL, url);
-    curl_easy_setopt(dl->handle, CURLOPT_WRITEFUNCTION,
-        curl_g_byte_array_writer);
-    curl_easy_setopt(dl->handle, CURLOPT_WRITEDATA, arr);
+G_DEFINE_QUARK(vocagtk-downloader-error-quark, vocagtk_downloader_error)
 
-    CURLcode rcode = curl_easy_perform(dl->handle);
-    if (err) *err = rcode;
+bool vocagtk_downloader_init(VocagtkDownloader *dl, char const *cache_path) {
+    memset(dl, 0, sizeof(*dl));
+    dl->cache_path = cache_path;
+    dl->flights = g_hash_table_new(g_str_hash, g_str_equal);
 
-    return arr;
+    char const *api_base = g_getenv("VOCAGTK_API_BASE");
+    char const *image_base = g_getenv("VOCAGTK_IMAGE_BASE");
+    if (!api_base || !*api_base) api_base = VOCAGTK_API_BASE;
+    if (!image_base || !*image_base) image_base = VOCAGTK_IMAGE_BASE;
+    dl->api_base = g_strdup(api_base);
+    dl->image_base = g_strdup(image_base);
+    if (g_str_has_suffix(dl->api_base, "/")) {
+        dl->api_base[strlen(dl->api_base) - 1] = '\0';
+    }
+    if (dl->image_base && g_str_has_suffix(dl->image_base, "/")) {
+        dl->image_base[strlen(dl->image_base) - 1] = '\0';
+    }
+    if (g_strcmp0(dl->api_base, VOCAGTK_API_BASE) != 0) {
+        DEBUG("Using API base %s", dl->api_base);
+    }
+
+    return vocagtk_engine_init(dl);
+}
+
+void vocagtk_downloader_clear(VocagtkDownloader *dl) {
+    vocagtk_engine_clear(dl);
+    g_clear_pointer(&dl->flights, g_hash_table_unref);
+    g_clear_pointer(&dl->api_base, g_free);
+    g_clear_pointer(&dl->image_base, g_free);
+}
+
+// Concurrent requests for the same key share one transfer. A waiter whose
+// cancellable fires leaves right away, the transfer itself is only
+// cancelled once nobody waits for it anymore.
+typedef struct {
+    VocagtkDownloader *dl;
+    char *key;
+    GPtrArray *waiters; // GTask *
+    GArray *handlers; // gulong, connected to the cancellable of each waiter
+    GCancellable *cancellable; // given to the shared transfer
+    guint prune_id; // idle source dropping cancelled waiters
+} Flight;
+
+static gboolean flight_prune_cb(gpointer user_data) {
+    Flight *flight = user_data;
+    flight->prune_id = 0;
+
+    for (guint i = flight->waiters->len; i-- > 0;) {
+        GTask *task = g_ptr_array_index(flight->waiters, i);
+        GCancellable *cancellable = g_task_get_cancellable(task);
+        if (!g_cancellable_is_cancelled(cancellable)) continue;
+
+        g_cancellable_disconnect(
+            cancellable, g_array_index(flight->handlers, gulong, i)
+        );
+        g_ptr_array_remove_index(flight->waiters, i);
+        g_array_remove_index(flight->handlers, i);
+
+        g_task_return_new_error(
+            task, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Request was cancelled"
+        );
+        g_object_unref(task);
+    }
+
+    if (flight->waiters->len == 0) {
+        // Later requests for the key must not join a cancelled transfer
+        if (g_hash_table_lookup(flight->dl->flights, flight->key) == flight) {
+            g_hash_table_remove(flight->dl->flights, flight->key);
+        }
+        g_cancellable_cancel(flight->cancellable);
+    }
+    return G_SOURCE_REMOVE;
 }
 
-// *INDENT-OFF*
-static inline yyjson_doc *vocagtk_downloader_json(
+// May run inside g_cancellable_connect, so only schedule the pruning
+static void flight_waiter_cancelled(GCancellable *cancellable, gpointer user_data) {
+    Flight *flight = user_data;
+    if (!flight->prune_id) flight->prune_id = g_idle_add(flight_prune_cb, flight);
+}
+
+static void flight_add_waiter(Flight *flight, GTask *task) {
+    GCancellable *cancellable = g_task_get_cancellable(task);
+    gulong handler = 0;
+
+    // Appended first, the handler may fire right away
+    g_ptr_array_add(flight->waiters, task);
+    g_array_append_val(flight->handlers, handler);
+    if (cancellable) {
+        handler = g_cancellable_connect(
+            cancellable, G_CALLBACK(flight_waiter_cancelled), flight, NULL
+        );
+        g_array_index(flight->handlers, gulong, flight->handlers->len - 1) =
+            handler;
+    }
+}
+
+// Returns a new flight if task is the first to ask for key, the caller then
+// starts the transfer with flight->cancellable. Returns NULL if task joined
+// a flight already in progress.
+static Flight *flight_join(VocagtkDownloader *dl, char const *key, GTask *task) {
+    Flight *flight = g_hash_table_lookup(dl->flights, key);
+    if (flight) {
+        DEBUG("Joined in-flight request for %s", key);
+        flight_add_waiter(flight, task);
+        return NULL;
+    }
+
+    flight = g_new0(Flight, 1);
+    flight->dl = dl;
+    flight->key = g_strdup(key);
+    flight->waiters = g_ptr_array_new();
+    flight->handlers = g_array_new(FALSE, FALSE, sizeof(gulong));
+    flight->cancellable = g_cancellable_new();
+    g_hash_table_insert(dl->flights, flight->key, flight);
+
+    flight_add_waiter(flight, task);
+    return flight;
+}
+
+// Ends the flight and returns every task still waiting for its result
+static GPtrArray *flight_land(Flight *flight) {
+    if (g_hash_table_lookup(flight->dl->flights, flight->key) == flight) {
+        g_hash_table_remove(flight->dl->flights, flight->key);
+    }
+    if (flight->prune_id) g_source_remove(flight->prune_id);
+
+    for (guint i = 0; i < flight->waiters->len; i++) {
+        GTask *task = g_ptr_array_index(flight->waiters, i);
+        gulong handler = g_array_index(flight->handlers, gulong, i);
+        if (handler) {
+            g_cancellable_disconnect(g_task_get_cancellable(task), handler);
+        }
+    }
+
+    GPtrArray *waiters = flight->waiters;
+    g_array_free(flight->handlers, TRUE);
+    g_object_unref(flight->cancellable);
+    g_free(flight->key);
+    g_free(flight);
+    return waiters;
+}
+
+// Fail task with what ended its transfer. Aborted through cancellable or
+// the cancellable of task, the transfer was cancelled rather than failed.
+static void task_return_curl_error(
+    GTask *task, CURLcode rcode, GCancellable *cancellable
+) {
+    if (
+        rcode == CURLE_ABORTED_BY_CALLBACK && (
+            g_cancellable_is_cancelled(cancellable)
+            || g_cancellable_is_cancelled(g_task_get_cancellable(task))
+        )
+    ) {
+        g_task_return_new_error(
+            task, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Request was cancelled"
+        );
+        return;
+    }
+    g_task_return_new_error(
+        task, VOCAGTK_DOWNLOADER_ERROR,
+        VOCAGTK_DOWNLOADER_ERROR_NETWORK,
+        "%s", curl_easy_strerror(rcode)
+    );
+}
+
+static yyjson_doc *body_to_json(GByteArray const *body) {
+    return yyjson_read((char *) body->data, body->len, YYJSON_READ_NOFLAG);
+}
+
+// Every request to the VocaDB API is paced by the rate limiter
+static VocagtkTransfer *api_transfer_new(
     VocagtkDownloader *dl,
-    char const *url
+    char const *url, gint64 max_age,
+    GCancellable *cancellable, gint64 deadline
+) {
+    VocagtkTransfer *xfer;
+    if (url[0] == '/') {
+        char *full = g_strconcat(dl->api_base, url, NULL);
+        xfer = vocagtk_transfer_new(dl, full);
+        g_free(full);
+    } else {
+        xfer = vocagtk_transfer_new(dl, url);
+    }
+    if (max_age > 0) vocagtk_transfer_set_max_age(xfer, max_age);
+    vocagtk_transfer_set_rate_limited(xfer);
+    vocagtk_transfer_set_cancellable(xfer, cancellable);
+    vocagtk_transfer_set_deadline(xfer, deadline);
+    return xfer;
+}
+
+static yyjson_doc *downloader_json_cached(
+    VocagtkDownloader *dl,
+    char const *url, gint64 max_age,
+    GCancellable *cancellable, gint64 deadline
 ) {
     yyjson_doc *r = NULL;
-    CURLcode err = CURLE_OK;
-    GByteArray *content = download(dl, url, &err);
+    VocagtkTransfer *xfer = api_transfer_new(
+        dl, url, max_age, cancellable, deadline
+    );
+    CURLcode err = vocagtk_transfer_perform(xfer);
     if (err != CURLE_OK) {
-        vocagtk_err_curl_rcode(err);
+        vocagtk_warn_curl_rcode(err);
     } else {
-        r = yyjson_read(
-            (char *) content->data, content->len,
-            YYJSON_READ_NOFLAG
-        );
+        r = body_to_json(xfer->body);
     }
-    g_byte_array_free(content, true);
+    vocagtk_transfer_free(xfer);
     return r;
 }
-// *INDENT-ON*
 
-yyjson_doc *vocagtk_downloader_album(VocagtkDownloader *dl, int id) {
+yyjson_doc *vocagtk_downloader_json(
+    VocagtkDownloader *dl,
+    char const *url,
+    GCancellable *cancellable, gint64 deadline
+) {
+    return downloader_json_cached(dl, url, 0, cancellable, deadline);
+}
+
+// Every caller gets a document of its own, parsing is cheap next to the
+// request which is shared.
+static void json_transfer_done(
+    VocagtkTransfer *xfer, CURLcode rcode,
+    gpointer user_data
+) {
+    GPtrArray *waiters = flight_land(user_data);
+
+    for (guint i = 0; i < waiters->len; i++) {
+        GTask *task = g_ptr_array_index(waiters, i);
+        yyjson_doc *doc = NULL;
+
+        if (rcode != CURLE_OK) {
+            task_return_curl_error(task, rcode, xfer->cancellable);
+        } else if ((doc = body_to_json(xfer->body))) {
+            g_task_return_pointer(
+                task, doc, (GDestroyNotify) yyjson_doc_free
+            );
+        } else {
+            g_task_return_new_error(
+                task, VOCAGTK_DOWNLOADER_ERROR,
+                VOCAGTK_DOWNLOADER_ERROR_PARSE,
+                "Invalid JSON from %s", xfer->url->str
+            );
+        }
+        g_object_unref(task);
+    }
+    g_ptr_array_unref(waiters);
+}
+
+static void downloader_json_cached_async(
+    VocagtkDownloader *dl,
+    char const *url, gint64 max_age,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, vocagtk_downloader_json_async);
+    Flight *flight = flight_join(dl, url, task);
+    if (!flight) return;
+
+    VocagtkTransfer *xfer = api_transfer_new(
+        dl, url, max_age, flight->cancellable, deadline
+    );
+    vocagtk_transfer_start(xfer, json_transfer_done, flight);
+}
+
+void vocagtk_downloader_json_async(
+    VocagtkDownloader *dl, char const *url,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    downloader_json_cached_async(
+        dl, url, 0, cancellable, deadline, callback, user_data
+    );
+}
+
+yyjson_doc *vocagtk_downloader_json_finish(GAsyncResult *res, GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, NULL), NULL);
+    return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+#define ALBUM_URL \
+    "/api/albums/%d" \
+    "?fields=Artists,MainPicture,Tracks&lang=Default"
+#define ARTIST_URL \
+    "/api/artists/%d" \
+    "?fields=MainPicture&lang=Default"
+#define SONG_URL \
+    "/api/songs/%d" \
+    "?fields=Albums,Artists,MainPicture&lang=Default"
+
+yyjson_doc *vocagtk_downloader_album(
+    VocagtkDownloader *dl, int id,
+    GCancellable *cancellable, gint64 deadline
+) {
     DEBUG("Try to fetch album %d.", id);
     char urlbuf[0x80] = {0};
-    g_snprintf(
-        urlbuf, 0x80,
-        "https://vocadb.net/api/albums/%d"
-        "?fields=Artists,MainPicture,Tracks&lang=Default", id
+    g_snprintf(urlbuf, 0x80, ALBUM_URL, id);
+    return downloader_json_cached(
+        dl, urlbuf, VOCAGTK_DOWNLOADER_ENTRY_TTL, cancellable, deadline
     );
-    return vocagtk_downloader_json(dl, urlbuf);
 }
-yyjson_doc *vocagtk_downloader_artist(VocagtkDownloader *dl, int id) {
+yyjson_doc *vocagtk_downloader_artist(
+    VocagtkDownloader *dl, int id,
+    GCancellable *cancellable, gint64 deadline
+) {
     DEBUG("Try to fetch artist %d.", id);
     char urlbuf[0x80] = {0};
-    g_snprintf(
-        urlbuf, 0x80,
-        "https://vocadb.net/api/artists/%d"
-        "?fields=MainPicture&lang=Default", id
+    g_snprintf(urlbuf, 0x80, ARTIST_URL, id);
+    return downloader_json_cached(
+        dl, urlbuf, VOCAGTK_DOWNLOADER_ENTRY_TTL, cancellable, deadline
     );
-    return vocagtk_downloader_json(dl, urlbuf);
 }
-yyjson_doc *vocagtk_downloader_song(VocagtkDownloader *dl, int id) {
+yyjson_doc *vocagtk_downloader_song(
+    VocagtkDownloader *dl, int id,
+    GCancellable *cancellable, gint64 deadline
+) {
     DEBUG("Try to fetch song %d.", id);
     char urlbuf[0x80] = {0};
-    g_snprintf(
-        urlbuf, 0x80,
-        "https://vocadb.net/api/songs/%d"
-        "?fields=Albums,Artists,MainPicture&lang=Default", id
+    g_snprintf(urlbuf, 0x80, SONG_URL, id);
+    return downloader_json_cached(
+        dl, urlbuf, VOCAGTK_DOWNLOADER_ENTRY_TTL, cancellable, deadline
+    );
+}
+
+typedef struct {
+    VocagtkDownloader *dl;
+    GPtrArray *urls; // char *
+    GPtrArray *docs; // yyjson_doc *, NULL until fetched
+    gint64 deadline;
+    guint next;
+    guint in_flight;
+} BatchTaskData;
+
+typedef struct {
+    GTask *task;
+    guint index;
+} BatchSlot;
+
+static void batch_task_data_free(BatchTaskData *data) {
+    g_ptr_array_unref(data->urls);
+    g_ptr_array_unref(data->docs);
+    g_free(data);
+}
+
+static void batch_item_done(
+    GObject *source, GAsyncResult *res,
+    gpointer user_data
+);
+
+// Keep up to VOCAGTK_DOWNLOADER_MAX_IN_FLIGHT requests running and
+// complete the task once all of them are done. Entries another caller is
+// already fetching are shared with it.
+static void batch_pump(GTask *task) {
+    BatchTaskData *data = g_task_get_task_data(task);
+    if (g_cancellable_is_cancelled(g_task_get_cancellable(task))) {
+        data->next = data->urls->len;
+    }
+
+    while (
+        data->in_flight < VOCAGTK_DOWNLOADER_MAX_IN_FLIGHT
+        && data->next < data->urls->len
+    ) {
+        BatchSlot *slot = g_new(BatchSlot, 1);
+        slot->task = task;
+        slot->index = data->next;
+
+        data->in_flight++;
+        downloader_json_cached_async(
+            data->dl, g_ptr_array_index(data->urls, data->next++),
+            VOCAGTK_DOWNLOADER_ENTRY_TTL,
+            g_task_get_cancellable(task), data->deadline,
+            batch_item_done, slot
+        );
+    }
+    if (data->in_flight > 0) return;
+
+    if (g_task_return_error_if_cancelled(task)) {
+        g_object_unref(task);
+        return;
+    }
+    g_task_return_pointer(
+        task, g_ptr_array_ref(data->docs),
+        (GDestroyNotify) g_ptr_array_unref
+    );
+    g_object_unref(task);
+}
+
+static void batch_item_done(
+    GObject *source, GAsyncResult *res,
+    gpointer user_data
+) {
+    BatchSlot *slot = user_data;
+    BatchTaskData *data = g_task_get_task_data(slot->task);
+
+    // Failed entries stay NULL, the transfer already logged why
+    yyjson_doc *doc = vocagtk_downloader_json_finish(res, NULL);
+    g_ptr_array_index(data->docs, slot->index) = doc;
+    data->in_flight--;
+
+    GTask *task = slot->task;
+    g_free(slot);
+    batch_pump(task);
+}
+
+static void downloader_batch_async(
+    VocagtkDownloader *dl, char const *url_fmt,
+    int const *ids, gsize n,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, downloader_batch_async);
+
+    BatchTaskData *data = g_new0(BatchTaskData, 1);
+    data->dl = dl;
+    data->deadline = deadline;
+    data->urls = g_ptr_array_new_full(n, g_free);
+    data->docs = g_ptr_array_new_full(n, (GDestroyNotify) yyjson_doc_free);
+    for (gsize i = 0; i < n; i++) {
+        g_ptr_array_add(data->urls, g_strdup_printf(url_fmt, ids[i]));
+        g_ptr_array_add(data->docs, NULL);
+    }
+    g_task_set_task_data(task, data, (GDestroyNotify) batch_task_data_free);
+
+    batch_pump(task);
+}
+
+void vocagtk_downloader_albums_async(
+    VocagtkDownloader *dl, int const *ids, gsize n,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    downloader_batch_async(
+        dl, ALBUM_URL, ids, n, cancellable, deadline, callback, user_data
+    );
+}
+void vocagtk_downloader_artists_async(
+    VocagtkDownloader *dl, int const *ids, gsize n,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    downloader_batch_async(
+        dl, ARTIST_URL, ids, n, cancellable, deadline, callback, user_data
+    );
+}
+void vocagtk_downloader_songs_async(
+    VocagtkDownloader *dl, int const *ids, gsize n,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    downloader_batch_async(
+        dl, SONG_URL, ids, n, cancellable, deadline, callback, user_data
     );
-    return vocagtk_downloader_json(dl, urlbuf);
 }
+
+GPtrArray *vocagtk_downloader_batch_finish(GAsyncResult *res, GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, NULL), NULL);
+    return g_task_propagate_pointer(G_TASK(res), error);
+}
+
 void vocagtk_downloader_search(
     VocagtkSearchQuery const *query, // in
     VocagtkResultIterator *iter // out
 ) {
     memset(iter, 0, sizeof(*iter));
-    iter->start = 0;
+    g_queue_init(&iter->pages);
+    iter->start = query->start;
+    iter->next_start = query->start;
     iter->page_size = VOCAGTK_DOWNLOADER_PAGE_SIZE;
+    iter->total = -1;
     iter->last_update_at = -1;
+    iter->max_age = VOCAGTK_DOWNLOADER_SEARCH_TTL;
 
+    // Typed by the user, may contain anything
+    char *escaped = g_uri_escape_string(query->query, NULL, false);
     iter->url = g_string_new(NULL);
     g_string_append_printf(
         iter->url,
-        "https://vocadb.net/api/entries"
-        "?fields=MainPicture&query=%s&maxResults=%lu"
-        "&entryTypes=%s&start=0",
-        query->query, iter->page_size, query->entry_type
+        "/api/entries"
+        "?fields=MainPicture&query=%s&entryTypes=%s&start=",
+        escaped, query->entry_type
     );
-    iter->start_offset_in_url = iter->url->len - 1;
+    g_free(escaped);
+    iter->start_offset_in_url = iter->url->len;
 }
-void vocagtk_downloader_update(
+static void append_date(GString *url, char const *name, time_t t) {
+    GDateTime *dt = g_date_time_new_from_unix_utc(t);
+    char *date = g_date_time_format(dt, "%Y-%m-%dT%H:%M:%SZ");
+    g_string_append_printf(url, "&%s=%s", name, date);
+    g_free(date);
+    g_date_time_unref(dt);
+}
+
+static void downloader_update(
     int artist_id, time_t last_update_at,
+    time_t before, size_t start,
     VocagtkResultIterator *iter // out
 ) {
     memset(iter, 0, sizeof(*iter));
-    iter->start = 0;
+    g_queue_init(&iter->pages);
+    iter->start = start;
+    iter->next_start = start;
     iter->page_size = VOCAGTK_DOWNLOADER_PAGE_SIZE;
+    iter->total = -1;
     iter->last_update_at = last_update_at;
 
     iter->url = g_string_new(NULL);
     g_string_append_printf(
         iter->url,
-        "https://vocadb.net/api/songs"
+        "/api/songs"
         "?fields=Albums,Artists,MainPicture&artistId[]=%d"
-        "&maxResults=%lu&sort=PublishDate&start=0",
-        artist_id, iter->page_size
+        "&sort=PublishDate&getTotalCount=true",
+        artist_id
     );
-    iter->start_offset_in_url = iter->url->len - 1;
+    // Let the server drop what is known already, an update without new
+    // songs is then an empty page. The bound is inclusive, songs published
+    // right at it are skipped by the publish date check.
+    if (last_update_at > 0) append_date(iter->url, "afterDate", last_update_at);
+    if (before > 0) append_date(iter->url, "beforeDate", before);
+    g_string_append(iter->url, "&start=");
+    iter->start_offset_in_url = iter->url->len;
+}
+
+void vocagtk_downloader_update(
+    int artist_id, time_t last_update_at,
+    VocagtkResultIterator *iter // out
+) {
+    downloader_update(artist_id, last_update_at, 0, 0, iter);
+}
+
+void vocagtk_downloader_update_resume(
+    int artist_id, time_t last_update_at,
+    time_t before, size_t start,
+    VocagtkResultIterator *iter // out
+) {
+    downloader_update(artist_id, last_update_at, before, start, iter);
+}
+// A result page being downloaded. It belongs to its transfer until the
+// transfer is done and to the iterator afterwards.
+struct _VocagtkPageFetch {
+    VocagtkJsonStream stream;
+    VocagtkResultIterator *iter; // NULL once the iterator let go of it
+    size_t start; // index of the first item of the page
+    size_t size; // maxResults
+    GCancellable *cancellable; // aborts the download of the page
+    GCancellable *link; // cancellable of the iterator, forwarded to ours
+    gulong link_id;
+    size_t dated_items; // items seen when last_publish_date was taken
+    time_t last_publish_date; // of the last item parsed, -1 if unknown
+    bool done;
+    CURLcode rcode;
+};
+
+static void page_fetch_unlink(VocagtkPageFetch *page) {
+    if (!page->link) return;
+    g_cancellable_disconnect(page->link, page->link_id);
+    g_clear_object(&page->link);
+}
+
+static void page_fetch_free(VocagtkPageFetch *page) {
+    page_fetch_unlink(page);
+    g_object_unref(page->cancellable);
+    vocagtk_json_stream_clear(&page->stream);
+    g_free(page);
+}
+
+// Hand the page over to whoever still holds it. A page nobody reads
+// anymore is cancelled, freeing its connection right away.
+static void page_fetch_release(VocagtkPageFetch *page) {
+    if (page->done) {
+        page_fetch_free(page);
+        return;
+    }
+    page->iter = NULL;
+    g_cancellable_cancel(page->cancellable);
 }
-yyjson_val *vocagtk_result_iterator_next(
+
+static void page_fetch_cancel_cb(GCancellable *link, gpointer user_data) {
+    VocagtkPageFetch *page = user_data;
+    g_cancellable_cancel(page->cancellable);
+}
+
+static double ewma(double avg, double x) {
+    return avg > 0 ? avg + (x - avg) / 4 : x;
+}
+
+// Compare the pages requested with what fixed size pages would have taken
+// to get as far, and remember how far an incremental update went.
+static void iterator_account(VocagtkResultIterator *iter) {
+    VocagtkDownloader *dl = iter->dl;
+    if (!dl || !iter->pages_requested) return;
+
+    gint fixed = iter->last_update_at == -1
+        ? 1 : (gint) (iter->start / VOCAGTK_DOWNLOADER_PAGE_SIZE) + 1;
+    g_atomic_int_add(&dl->stats.pages, (gint) iter->pages_requested);
+    g_atomic_int_add(&dl->stats.pages_fixed, fixed);
+
+    if (iter->last_update_at > 0) {
+        dl->paging.new_items = ewma(dl->paging.new_items, iter->start);
+    }
+}
+
+static void iterator_clear(VocagtkResultIterator *iter) {
+    iterator_account(iter);
+    if (iter->pump_id) g_source_remove(iter->pump_id);
+    VocagtkPageFetch *page;
+    while ((page = g_queue_pop_head(&iter->pages))) page_fetch_release(page);
+    g_clear_object(&iter->cancellable);
+    yyjson_doc_free(iter->doc);
+    yyjson_doc_free(iter->item);
+    if (iter->url) g_string_free(iter->url, true);
+    memset(iter, 0, sizeof(*iter));
+}
+
+static void page_fetch_link(VocagtkPageFetch *page, GCancellable *link) {
+    page_fetch_unlink(page);
+    if (!link) return;
+    page->link = g_object_ref(link);
+    page->link_id = g_cancellable_connect(
+        page->link, G_CALLBACK(page_fetch_cancel_cb), page, NULL
+    );
+}
+
+// Pages still downloading follow the new cancellable of the iterator
+static void iterator_link(
+    VocagtkResultIterator *iter, GCancellable *cancellable
+) {
+    if (iter->cancellable == cancellable) return;
+    g_set_object(&iter->cancellable, cancellable);
+    for (GList *l = iter->pages.head; l; l = l->next) {
+        VocagtkPageFetch *page = l->data;
+        if (!page->done) page_fetch_link(page, cancellable);
+    }
+}
+
+void vocagtk_result_iterator_set_cancellable(
     VocagtkResultIterator *iter,
-    VocagtkDownloader *dl, CURLcode *err
-) {
-    if (iter->start % iter->page_size == 0) {
-        if (iter->start != 0 && iter->last_update_at == -1) goto clean;
-        iter->url->len = iter->start_offset_in_url;
-        g_string_append_printf(iter->url, "%lu", iter->start);
-
-        yyjson_doc_free(iter->doc);
-        iter->doc = vocagtk_downloader_json(dl, iter->url->str);
-
-        yyjson_val *root = yyjson_doc_get_root(iter->doc);
-        yyjson_val *arr = yyjson_obj_get(root, "items");
-        yyjson_arr_iter_init(arr, &iter->iter);
-    }
-    yyjson_val *next = yyjson_arr_iter_next(&iter->iter);
-    if (!next) goto clean;
-
-    // Check publish date if last_update_at is set
-    if (iter->last_update_at >= 0) {
-        yyjson_val *publish_date_val = yyjson_obj_get(next, "publishDate");
-        if (yyjson_is_str(publish_date_val)) {
-            char const *publish_date_str = yyjson_get_str(publish_date_val);
-            time_t publish_date = parse_iso8601_datetime(publish_date_str);
-
-            if (publish_date >= 0 && publish_date <= iter->last_update_at) {
-                DEBUG(
-                    "Song publish date %s (%ld) is before or equal to last update %ld, stopping iteration",
-                      publish_date_str, publish_date, iter->last_update_at);
-                goto clean;
-            }
-        }
+    GCancellable *cancellable, gint64 deadline
+) {
+    iterator_link(iter, cancellable);
+    iter->deadline = deadline;
+}
+
+void vocagtk_result_iterator_clear(VocagtkResultIterator *iter) {
+    GTask *task = iter->pending;
+    iterator_clear(iter);
+    if (!task) return;
+
+    g_task_return_new_error(
+        task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+        "Result iterator was cleared"
+    );
+    g_object_unref(task);
+}
+
+// Whether an update has reached the songs known since the last one
+static bool iterator_item_old(
+    VocagtkResultIterator const *iter, yyjson_val *item
+) {
+    if (iter->last_update_at < 0) return false;
+
+    yyjson_val *publish_date_val = yyjson_obj_get(item, "publishDate");
+    if (!yyjson_is_str(publish_date_val)) return false;
+    char const *publish_date_str = yyjson_get_str(publish_date_val);
+    time_t publish_date = parse_iso8601_datetime(publish_date_str);
+
+    if (publish_date >= 0 && publish_date <= iter->last_update_at) {
+        DEBUG(
+            "Song publish date %s (%ld) is before or equal to last update %ld, stopping iteration",
+              publish_date_str, publish_date, iter->last_update_at);
+        return true;
+    }
+    return false;
+}
+
+// Takes ownership of doc, an element of the items array
+static yyjson_val *iterator_take(VocagtkResultIterator *iter, yyjson_doc *doc) {
+    yyjson_doc_free(iter->item);
+    iter->item = doc;
+    yyjson_val *next = yyjson_doc_get_root(doc);
+
+    if (iterator_item_old(iter, next)) {
+        iterator_clear(iter);
+        return NULL;
     }
 
     iter->start++;
     return next;
+}
+
+// Whether another page should be requested now. Pages are requested one
+// ahead of the consumer once the previous one showed there is more. A
+// backfill knowing the total count fans out over a window of pages
+// instead, they are still consumed in order.
+static bool iterator_wants_page(VocagtkResultIterator const *iter) {
+    if (iter->ended) return false;
+    if (iter->total >= 0 && (gint64) iter->next_start >= iter->total) {
+        return false;
+    }
+
+    guint queued = iter->pages.length;
+    if (queued == 0) return true;
+    // Searches are scrolled through, the next page is only worth it once
+    // the consumer drained the current one
+    if (iter->last_update_at == -1) return false;
+    if (iter->total >= 0 && iter->last_update_at == 0) {
+        return queued < VOCAGTK_DOWNLOADER_PAGE_WINDOW;
+    }
+    VocagtkPageFetch const *tail = g_queue_peek_tail(&iter->pages);
+    return queued < 2 && tail->done;
+}
+
+// Pick maxResults of the next page. Incremental updates usually stop
+// after a few songs, so they start small and grow page by page. Backfills
+// use pages big enough for the request overhead to be small next to the
+// time spent receiving the body. Searches only show one page.
+static size_t iterator_page_size(VocagtkResultIterator const *iter) {
+    if (iter->last_update_at == -1) return VOCAGTK_DOWNLOADER_PAGE_SIZE;
+    VocagtkPaging const *p = &iter->dl->paging;
+
+    size_t bulk = VOCAGTK_DOWNLOADER_PAGE_MAX;
+    if (p->bytes_per_item > 0 && p->bytes_per_us > 0) {
+        bulk = (size_t) (
+            4 * p->first_byte_us * p->bytes_per_us / p->bytes_per_item
+        );
+    }
+
+    size_t size = bulk;
+    if (iter->last_update_at > 0) {
+        size = iter->next_start == 0
+            ? (size_t) (2 * p->new_items) + VOCAGTK_DOWNLOADER_PAGE_MIN
+            : MIN(2 * iter->page_size, bulk);
+    }
+    return CLAMP(
+        size, VOCAGTK_DOWNLOADER_PAGE_MIN, VOCAGTK_DOWNLOADER_PAGE_MAX
+    );
+}
+
+// Learn the cost of a request from a page which came over the network
+static void iterator_observe(
+    VocagtkResultIterator *iter,
+    VocagtkTransfer *xfer, VocagtkPageFetch const *page
+) {
+    size_t n = page->stream.n_items;
+    if (page->rcode != CURLE_OK || xfer->from_cache) return;
+    if (n == 0 || xfer->wire_bytes == 0) return; // e.g. 304 Not Modified
+
+    curl_off_t first_byte = 0, total = 0;
+    curl_easy_getinfo(xfer->handle, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(xfer->handle, CURLINFO_TOTAL_TIME_T, &total);
+
+    VocagtkPaging *p = &iter->dl->paging;
+    p->bytes_per_item = ewma(p->bytes_per_item, (double) xfer->wire_bytes / n);
+    p->first_byte_us = ewma(p->first_byte_us, (double) first_byte);
+    if (total > first_byte) {
+        p->bytes_per_us = ewma(
+            p->bytes_per_us, (double) xfer->wire_bytes / (total - first_byte)
+        );
+    }
+}
+
+static void page_fetch_sink(
+    VocagtkTransfer *xfer, char const *data, size_t len,
+    gpointer user_data
+);
+
+// Queue a new page starting at iter->next_start
+static VocagtkTransfer *iterator_new_page(VocagtkResultIterator *iter) {
+    VocagtkPageFetch *page = g_new0(VocagtkPageFetch, 1);
+    vocagtk_json_stream_init(&page->stream);
+    page->last_publish_date = -1;
+    page->iter = iter;
+    page->start = iter->next_start;
+    page->cancellable = g_cancellable_new();
+    page_fetch_link(page, iter->cancellable);
+    page->size = iterator_page_size(iter);
+    g_queue_push_tail(&iter->pages, page);
+    iter->page_size = page->size;
+    iter->next_start += page->size;
+    iter->pages_requested++;
+
+    iter->url->len = iter->start_offset_in_url;
+    g_string_append_printf(
+        iter->url, "%lu&maxResults=%lu", page->start, page->size
+    );
+
+    VocagtkTransfer *xfer = api_transfer_new(
+        iter->dl, iter->url->str, iter->max_age,
+        page->cancellable, iter->deadline
+    );
+    vocagtk_transfer_set_sink(xfer, page_fetch_sink, page);
+    return xfer;
+}
+
+// Returns false if the page was abandoned and freed
+static bool page_fetch_done(VocagtkPageFetch *page, CURLcode rcode) {
+    page->done = true;
+    page->rcode = rcode;
+    page_fetch_unlink(page);
+
+    VocagtkResultIterator *iter = page->iter;
+    if (!iter) {
+        page_fetch_free(page);
+        return false;
+    }
+    if (rcode != CURLE_OK) {
+        // The consumer gets the error once it reaches this page
+        iter->ended = true;
+        return true;
+    }
 
-clean:
     yyjson_doc_free(iter->doc);
-    g_string_free(iter->url, true);
-    memset(iter, 0, sizeof(*iter));
-    return NULL;
+    iter->doc = vocagtk_json_stream_envelope(&page->stream);
+    yyjson_val *total = yyjson_obj_get(yyjson_doc_get_root(iter->doc), "totalCount");
+    if (iter->total < 0 && yyjson_is_int(total)) {
+        iter->total = yyjson_get_sint(total);
+    }
+
+    // Decide whether the next page is worth requesting
+    if (page->stream.n_items < page->size) {
+        iter->ended = true;
+    } else if (
+        iter->last_update_at >= 0 && page->last_publish_date >= 0
+        && page->last_publish_date <= iter->last_update_at
+    ) {
+        iter->ended = true;
+    }
+    return true;
 }
 
-CURLcode vocagtk_downloader_image(
-    VocagtkDownloader *dl,
-    char const *url,
-    char const *out_path
+static void iterator_page_done(
+    VocagtkTransfer *xfer, CURLcode rcode,
+    gpointer user_data
+);
+
+// Start downloading pages ahead of the consumer
+static void iterator_fill(VocagtkResultIterator *iter) {
+    while (iterator_wants_page(iter)) {
+        VocagtkTransfer *xfer = iterator_new_page(iter);
+        vocagtk_transfer_start(
+            xfer, iterator_page_done, g_queue_peek_tail(&iter->pages)
+        );
+    }
+}
+
+// Complete the pending next_async call if there is enough to answer it,
+// requesting more pages when needed.
+static void iterator_pump(VocagtkResultIterator *iter) {
+    GTask *task = iter->pending;
+    if (!task) return;
+
+    for (;;) {
+        VocagtkPageFetch *page = g_queue_peek_head(&iter->pages);
+        if (!page) {
+            iterator_fill(iter);
+            if (g_queue_is_empty(&iter->pages)) break;
+            return; // wait for the page
+        }
+
+        yyjson_doc *doc = vocagtk_json_stream_pop(&page->stream);
+        if (doc) {
+            iter->item_page = page->start;
+            iter->pending = NULL;
+            g_task_return_pointer(task, iterator_take(iter, doc), NULL);
+            g_object_unref(task);
+            return;
+        }
+        if (!page->done) return; // wait for more of the page
+
+        if (page->rcode != CURLE_OK) {
+            iter->pending = NULL;
+            // The page goes with the iterator, which task may reuse
+            CURLcode rcode = page->rcode;
+            GCancellable *cancellable = g_object_ref(page->cancellable);
+            iterator_clear(iter);
+            task_return_curl_error(task, rcode, cancellable);
+            g_object_unref(cancellable);
+            g_object_unref(task);
+            return;
+        }
+        page_fetch_free(g_queue_pop_head(&iter->pages));
+        iterator_fill(iter);
+    }
+
+    iter->pending = NULL;
+    iterator_clear(iter);
+    g_task_return_pointer(task, NULL, NULL);
+    g_object_unref(task);
+}
+
+static gboolean iterator_pump_idle(gpointer user_data) {
+    VocagtkResultIterator *iter = user_data;
+    iter->pump_id = 0;
+    iterator_pump(iter);
+    return G_SOURCE_REMOVE;
+}
+
+static void page_fetch_sink(
+    VocagtkTransfer *xfer, char const *data, size_t len,
+    gpointer user_data
 ) {
-    // Check if file already exists
-    if (g_file_test(out_path, G_FILE_TEST_EXISTS)) {
-        //DEBUG("Image already cached at: %s", out_path);
-        return CURLE_OK;
+    VocagtkPageFetch *page = user_data;
+    vocagtk_json_stream_feed(&page->stream, data, len);
+
+    // Items parsed by this feed are still queued, the consumer may pop
+    // them before the page is done
+    yyjson_doc *last = g_queue_peek_tail(&page->stream.items);
+    if (last && page->stream.n_items != page->dated_items) {
+        page->dated_items = page->stream.n_items;
+        yyjson_val *date = yyjson_obj_get(
+            yyjson_doc_get_root(last), "publishDate"
+        );
+        page->last_publish_date = yyjson_is_str(date)
+            ? parse_iso8601_datetime(yyjson_get_str(date)) : -1;
+    }
+
+    // Runs inside curl, the caller must not be called back from here
+    VocagtkResultIterator *iter = page->iter;
+    if (
+        iter && iter->pending && !iter->pump_id
+        && g_queue_peek_head(&iter->pages) == page
+        && !g_queue_is_empty(&page->stream.items)
+    ) {
+        iter->pump_id = g_idle_add(iterator_pump_idle, iter);
     }
+}
+
+static void iterator_page_done(
+    VocagtkTransfer *xfer, CURLcode rcode,
+    gpointer user_data
+) {
+    VocagtkPageFetch *page = user_data;
+    if (!page_fetch_done(page, rcode)) return;
+
+    // Prefetch behind the consumer even if nobody is waiting right now
+    VocagtkResultIterator *iter = page->iter;
+    iterator_observe(iter, xfer, page);
+    iterator_fill(iter);
+    if (g_queue_peek_head(&iter->pages) == page) iterator_pump(iter);
+}
+
+void vocagtk_result_iterator_next_async(
+    VocagtkResultIterator *iter, VocagtkDownloader *dl,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    g_return_if_fail(iter->pending == NULL);
+
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, vocagtk_result_iterator_next_async);
 
-    FILE *f = fopen(out_path, "wb");
+    iter->dl = dl;
+    iter->pending = task;
+    if (cancellable) iterator_link(iter, cancellable);
+    iterator_pump(iter);
+}
+
+yyjson_val *vocagtk_result_iterator_next_finish(
+    VocagtkResultIterator *iter,
+    GAsyncResult *res, GError **error
+) {
+    g_return_val_if_fail(g_task_is_valid(res, NULL), NULL);
+    return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+// Images are downloaded next to out_path and renamed into place once
+// complete, so a half written file is never taken as cached.
+static FILE *image_open_tmp(char const *out_path, char **tmp_path) {
+    char *dir = g_path_get_dirname(out_path);
+    g_mkdir_with_parents(dir, 0755);
+    g_free(dir);
+
+    *tmp_path = g_strconcat(out_path, ".XXXXXX", NULL);
+    int fd = g_mkstemp(*tmp_path);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "wb");
     if (!f) {
-        vocagtk_warn_def("Failed to open file for writing: %s", out_path);
-        return CURLE_WRITE_ERROR;
+        vocagtk_warn_def("Failed to open file for writing: %s", *tmp_path);
+        if (fd >= 0) {
+            g_close(fd, NULL);
+            g_remove(*tmp_path);
+        }
+        g_clear_pointer(tmp_path, g_free);
+    }
+    return f;
+}
+
+// Closes f and moves the download into place, or drops it on failure
+static CURLcode image_commit(
+    FILE *f, char const *tmp_path, char const *out_path,
+    CURLcode rcode
+) {
+    if (fclose(f) != 0 && rcode == CURLE_OK) rcode = CURLE_WRITE_ERROR;
+    if (rcode == CURLE_OK && g_rename(tmp_path, out_path) != 0) {
+        vocagtk_warn_def("Failed to move %s to %s", tmp_path, out_path);
+        rcode = CURLE_WRITE_ERROR;
     }
+    if (rcode != CURLE_OK) g_remove(tmp_path);
+    return rcode;
+}
 
-    curl_easy_reset(dl->handle);
-    curl_easy_setopt(dl->handle, CURLOPT_URL, url);
-    curl_easy_setopt(dl->handle, CURLOPT_WRITEFUNCTION, fwrite);
-    curl_easy_setopt(dl->handle, CURLOPT_WRITEDATA, f);
-    CURLcode rc = curl_easy_perform(dl->handle);
-    fclose(f);
+// Where url is actually fetched from, owned by the caller
+static char *image_url(VocagtkDownloader *dl, char const *url) {
+    char const *host = strstr(url, "://");
+    if (!dl->image_base || !host) return g_strdup(url);
+    return g_strdup_printf("%s/%s", dl->image_base, host + 3);
+}
 
-    if (rc == CURLE_OK) {
-        DEBUG("Downloaded image to: %s", out_path);
+// One download shared by every task waiting for url
+typedef struct {
+    VocagtkDownloader *dl;
+    Flight *flight;
+    FILE *file;
+    char *url;
+    char *path;
+    char *tmp_path;
+} ImageDownload;
+
+static void image_transfer_done(
+    VocagtkTransfer *xfer, CURLcode rcode,
+    gpointer user_data
+) {
+    ImageDownload *img = user_data;
+
+    // Where the file ends is its size, taken before image_commit closes it
+    gint64 bytes = ftell(img->file);
+    rcode = image_commit(img->file, img->tmp_path, img->path, rcode);
+    if (rcode == CURLE_OK) {
+        DEBUG("Downloaded image to: %s", img->path);
+        vocagtk_image_cache_add(&img->dl->image_cache, img->url, bytes);
     }
+    vocagtk_image_cache_release(&img->dl->image_cache, img->url);
+
+    GPtrArray *waiters = flight_land(img->flight);
+    for (guint i = 0; i < waiters->len; i++) {
+        GTask *task = g_ptr_array_index(waiters, i);
+        if (rcode != CURLE_OK) {
+            task_return_curl_error(task, rcode, xfer->cancellable);
+        } else {
+            g_task_return_boolean(task, true);
+        }
+        g_object_unref(task);
+    }
+    g_ptr_array_unref(waiters);
+
+    g_free(img->url);
+    g_free(img->path);
+    g_free(img->tmp_path);
+    g_free(img);
+}
+
+void vocagtk_downloader_image_async(
+    VocagtkDownloader *dl, char const *url,
+    GCancellable *cancellable, gint64 deadline,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, vocagtk_downloader_image_async);
+
+    if (vocagtk_image_cache_contains(&dl->image_cache, url)) {
+        g_task_return_boolean(task, true);
+        g_object_unref(task);
+        return;
+    }
+
+    // Rows showing the same cover share one download
+    char *out_path = vocagtk_image_cache_path(&dl->image_cache, url);
+    Flight *flight = flight_join(dl, out_path, task);
+    if (!flight) {
+        g_free(out_path);
+        return;
+    }
+
+    // Eviction of an older copy must not remove the download
+    vocagtk_image_cache_hold(&dl->image_cache, url);
+    char *tmp_path = NULL;
+    FILE *f = image_open_tmp(out_path, &tmp_path);
+    if (!f) {
+        vocagtk_image_cache_release(&dl->image_cache, url);
+        g_ptr_array_unref(flight_land(flight));
+        g_task_return_new_error(
+            task, G_IO_ERROR, G_IO_ERROR_FAILED,
+            "Failed to open file for writing: %s", out_path
+        );
+        g_object_unref(task);
+        g_free(out_path);
+        return;
+    }
+
+    ImageDownload *img = g_new0(ImageDownload, 1);
+    img->dl = dl;
+    img->flight = flight;
+    img->file = f;
+    img->url = g_strdup(url);
+    img->path = out_path;
+    img->tmp_path = tmp_path;
+
+    char *real_url = image_url(dl, url);
+    VocagtkTransfer *xfer = vocagtk_transfer_new(dl, real_url);
+    g_free(real_url);
+    vocagtk_transfer_set_file(xfer, f);
+    vocagtk_transfer_set_cancellable(xfer, flight->cancellable);
+    vocagtk_transfer_set_deadline(xfer, deadline);
+    vocagtk_transfer_start(xfer, image_transfer_done, img);
+}
 
-    return rc;
+bool vocagtk_downloader_image_finish(GAsyncResult *res, GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, NULL), false);
+    return g_task_propagate_boolean(G_TASK(res), error);
 }
@@ -2,6 +2,7 @@
 #include "entrybox.h"
 #include "exterr.h"
 #include "helper.h"
+#include "thumb.h"
 #include "ui.h"
 
 G_DEFINE_TYPE(VocagtkEntryBox, vocagtk_entry_box, GTK_TYPE_BOX)
@@ -42,7 +43,14 @@ static void view_src(GtkButton *_, VocagtkEntryBox *box) {
     g_object_unref(launcher);
 }
 
+static void cancel_image(VocagtkEntryBox *self) {
+    if (!self->image_cancellable) return;
+    g_cancellable_cancel(self->image_cancellable);
+    g_clear_object(&self->image_cancellable);
+}
+
 static void vocagtk_entry_box_dispose(GObject *obj) {
+    cancel_image(VOCAGTK_ENTRY_BOX(obj));
     gtk_widget_dispose_template(GTK_WIDGET(obj), VOCAGTK_TYPE_ENTRY_BOX);
     G_OBJECT_CLASS(vocagtk_entry_box_parent_class)->dispose(obj);
 }
@@ -81,10 +89,52 @@ static void vocagtk_entry_box_init(VocagtkEntryBox *self) {
     self->list = NULL;
     self->entry = NULL;
     self->item = NULL;
+    self->image_cancellable = NULL;
+}
+
+static char const *const fallback_image = "example/unknown.png";
+// Shown while the image is loading
+static char const *const placeholder_icon = "image-loading-symbolic";
+
+typedef struct {
+    VocagtkEntryBox *box;
+    VocagtkEntry *entry; // the entry the image was requested for
+} ImageRequest;
+
+static void image_ready(GObject *source, GAsyncResult *res, gpointer user_data) {
+    ImageRequest *req = user_data;
+
+    GError *error = NULL;
+    GdkTexture *texture = vocagtk_thumb_load_finish(res, &error);
+
+    // The box may have been rebound to another entry meanwhile
+    bool cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    if (req->box->entry == req->entry && !cancelled) {
+        if (texture) {
+            gtk_image_set_from_paintable(
+                req->box->image, GDK_PAINTABLE(texture)
+            );
+        } else {
+            // Download or decode failed, use fallback
+            DEBUG(
+                "Failed to load image of %s: %s",
+                vocagtk_entry_get_main_info(req->entry), error->message
+            );
+            gtk_image_set_from_file(req->box->image, fallback_image);
+        }
+    }
+
+    if (texture) g_object_unref(texture);
+    if (error) g_error_free(error);
+    g_object_unref(req->box);
+    g_object_unref(req->entry);
+    g_free(req);
 }
 
 void vocagtk_entry_box_bind(VocagtkEntryBox *self, VocagtkEntry *entry) {
     self->entry = entry;
+    // Rows scrolled past must not keep their image loads going
+    cancel_image(self);
 
     char const *label = NULL;
     switch (entry->type_label) {
@@ -108,69 +158,34 @@ void vocagtk_entry_box_bind(VocagtkEntryBox *self, VocagtkEntry *entry) {
 
     // Get image URL from entry
     char const *image_url = vocagtk_entry_get_image(entry);
-    char const *fallback_image = "example/unknown.png";
-
-    do {
-        if (!image_url) {
-            // No image URL available, use fallback
-            gtk_image_set_from_file(self->image, fallback_image);
-            break;
-        }
-
-        // Extract filename from URL
-        char const *filename = image_url + strlen(image_url);
-        while (*filename != '/' && filename != image_url) filename--;
 
-        if (filename == image_url) {
-            // Failed to extract filename, use fallback
-            DEBUG("Failed to extract filename from URL: %s", image_url);
-            gtk_image_set_from_file(self->image, fallback_image);
-            break;
-        }
-
-        // Build cache file path
-        GString *cache_path =
-            g_string_new(self->list->app->dl.cache_path);
-        g_string_append(cache_path, filename);
-
-        // Download image to cache if not exists
-        CURLcode curl_err = vocagtk_downloader_image(
-            &self->list->app->dl, image_url, cache_path->str
-        );
-
-        if (curl_err != CURLE_OK) {
-            // Download failed, use fallback
-            DEBUG(
-                "Failed to download image from %s, error: %s",
-                image_url, curl_easy_strerror(curl_err)
-            );
-            gtk_image_set_from_file(self->image, fallback_image);
-            g_string_free(cache_path, TRUE);
-            break;
-        }
-
-        // Load image as GdkTexture
-        GError *error = NULL;
-        GdkTexture *texture = gdk_texture_new_from_filename(cache_path->str, &error);
-
-        if (!texture) {
-            // Failed to load texture, use fallback
-            DEBUG(
-                "Failed to load texture from %s: %s",
-                cache_path->str, error ? error->message : "unknown error"
-            );
-            if (error) g_error_free(error);
-            gtk_image_set_from_file(self->image, fallback_image);
-            g_string_free(cache_path, TRUE);
-            break;
-        }
-
-        // Successfully loaded texture, set image
+    // Thumbnails are scaled to the device pixels of the image
+    int size = gtk_image_get_pixel_size(self->image)
+        * gtk_widget_get_scale_factor(GTK_WIDGET(self->image));
+    GdkTexture *texture = image_url
+        ? vocagtk_thumb_lookup(image_url, size) : NULL;
+    if (!image_url) {
+        // No image URL available, use fallback
+        gtk_image_set_from_file(self->image, fallback_image);
+    } else if (texture) {
+        // Shown elsewhere or scrolled past recently, still an access of the
+        // image on disk as far as its eviction goes
         gtk_image_set_from_paintable(self->image, GDK_PAINTABLE(texture));
         g_object_unref(texture);
-        //DEBUG("Loaded image texture from cache: %s", cache_path->str);
-        g_string_free(cache_path, TRUE);
-    } while (0);
+        vocagtk_image_cache_touch(&self->list->app->dl.image_cache, image_url);
+    } else {
+        // Reading and decoding happen off the main thread, rows showing the
+        // same image share its download
+        gtk_image_set_from_icon_name(self->image, placeholder_icon);
+        ImageRequest *req = g_new0(ImageRequest, 1);
+        req->box = g_object_ref(self);
+        req->entry = g_object_ref(entry);
+        self->image_cancellable = g_cancellable_new();
+        vocagtk_thumb_load_async(
+            &self->list->app->dl, image_url, size,
+            self->image_cancellable, image_ready, req
+        );
+    }
 
     gtk_label_set_label(self->main_info, vocagtk_entry_get_main_info(entry));
     gtk_label_set_label(self->sub_info, vocagtk_entry_get_sub_info(entry));
@@ -0,0 +1,239 @@
+#include <glib.h>
+#include <sqlite3.h>
+
+#include "exterr.h"
+#include "helper.h"
+#include "httpcache.h"
+
+static void http_cache_sum(VocagtkHttpCache *cache) {
+    char const *sql = "SELECT COALESCE(SUM(size), 0) FROM response;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        cache->total_bytes = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+}
+
+// Drop the least recently used responses until the cache fits max_bytes
+static void http_cache_evict(VocagtkHttpCache *cache) {
+    if (cache->total_bytes <= cache->max_bytes) return;
+
+    char const *sql =
+        "DELETE FROM response WHERE url IN ("
+        "SELECT url FROM ("
+        "SELECT url, SUM(size) OVER (ORDER BY accessed_at DESC, url) AS kept "
+        "FROM response"
+        ") WHERE kept > ?"
+        ");";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+    sqlite3_bind_int64(stmt, 1, cache->max_bytes);
+    rcode = sqlite3_step(stmt);
+    if (rcode != SQLITE_DONE) vocagtk_warn_sql_db(cache->db);
+    else DEBUG("Evicted %d cached responses", sqlite3_changes(cache->db));
+    sqlite3_finalize(stmt);
+
+    http_cache_sum(cache);
+}
+
+bool vocagtk_http_cache_open(
+    VocagtkHttpCache *cache,
+    char const *path, gint64 max_bytes
+) {
+    memset(cache, 0, sizeof(*cache));
+    cache->max_bytes = max_bytes;
+
+    int rcode = sqlite3_open(path, &cache->db);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_rcode(rcode);
+        sqlite3_close(cache->db);
+        cache->db = NULL;
+        return false;
+    }
+
+    char const *sqls[] = {
+        // The cache can always be rebuilt, trade durability for speed
+        "PRAGMA journal_mode = WAL;",
+        "PRAGMA synchronous = OFF;",
+
+        "CREATE TABLE IF NOT EXISTS response("
+        "url TEXT PRIMARY KEY,"
+        "body BLOB, etag TEXT, last_modified TEXT,"
+        "expires_at INTEGER, accessed_at INTEGER, size INTEGER"
+        ");",
+
+        "CREATE INDEX IF NOT EXISTS response_lru ON response(accessed_at);",
+    };
+
+    char *errmsg;
+    for (gsize i = 0; i < G_N_ELEMENTS(sqls); ++i) {
+        if (sqlite3_exec(cache->db, sqls[i], NULL, NULL, &errmsg) != SQLITE_OK) {
+            vocagtk_warn_sql("%s", errmsg);
+            sqlite3_free(errmsg);
+        }
+    }
+
+    http_cache_sum(cache);
+    http_cache_evict(cache);
+    return true;
+}
+
+void vocagtk_http_cache_close(VocagtkHttpCache *cache) {
+    if (!cache->db) return;
+    DEBUG(
+        "HTTP cache: %u hits, %u revalidated, %u misses",
+        cache->hits, cache->revalidated, cache->misses
+    );
+    sqlite3_close(cache->db);
+    cache->db = NULL;
+}
+
+void vocagtk_http_cache_set_max_bytes(
+    VocagtkHttpCache *cache, gint64 max_bytes
+) {
+    cache->max_bytes = max_bytes;
+    if (cache->db) http_cache_evict(cache);
+}
+
+static void http_cache_touch(VocagtkHttpCache *cache, char const *url) {
+    char const *sql = "UPDATE response SET accessed_at = ? WHERE url = ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+    sqlite3_bind_int64(stmt, 1, g_get_real_time());
+    sqlite3_bind_text(stmt, 2, url, -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) != SQLITE_DONE) vocagtk_warn_sql_db(cache->db);
+    sqlite3_finalize(stmt);
+}
+
+VocagtkHttpCacheEntry *vocagtk_http_cache_lookup(
+    VocagtkHttpCache *cache, char const *url
+) {
+    if (!cache->db) return NULL;
+
+    char const *sql =
+        "SELECT body, etag, last_modified, expires_at "
+        "FROM response WHERE url = ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return NULL;
+    }
+    sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
+
+    VocagtkHttpCacheEntry *entry = NULL;
+    rcode = sqlite3_step(stmt);
+    if (rcode == SQLITE_ROW) {
+        entry = g_new0(VocagtkHttpCacheEntry, 1);
+        entry->body = g_bytes_new(
+            sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)
+        );
+        entry->etag = g_strdup(sqlite3_column_str(stmt, 1));
+        entry->last_modified = g_strdup(sqlite3_column_str(stmt, 2));
+        entry->fresh = sqlite3_column_int64(stmt, 3) > time(NULL);
+    } else if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(cache->db);
+    }
+    sqlite3_finalize(stmt);
+
+    if (entry && entry->fresh) {
+        cache->hits++;
+        http_cache_touch(cache, url);
+    } else {
+        cache->misses++;
+    }
+    return entry;
+}
+
+void vocagtk_http_cache_entry_free(VocagtkHttpCacheEntry *entry) {
+    if (!entry) return;
+    g_bytes_unref(entry->body);
+    g_free(entry->etag);
+    g_free(entry->last_modified);
+    g_free(entry);
+}
+
+void vocagtk_http_cache_store(
+    VocagtkHttpCache *cache, char const *url,
+    guint8 const *body, gsize len,
+    char const *etag, char const *last_modified,
+    gint64 max_age
+) {
+    if (!cache->db) return;
+
+    char const *sql =
+        "INSERT INTO response"
+        "(url, body, etag, last_modified, expires_at, accessed_at, size) "
+        "VALUES(?, ?, ?, ?, ?, ?, ?) "
+        "ON CONFLICT(url) DO UPDATE SET "
+        "body = excluded.body, "
+        "etag = excluded.etag, "
+        "last_modified = excluded.last_modified, "
+        "expires_at = excluded.expires_at, "
+        "accessed_at = excluded.accessed_at, "
+        "size = excluded.size;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+
+    // Account for the URL too, small responses are dominated by it
+    gint64 size = (gint64) len + (gint64) strlen(url);
+
+    sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
+    sqlite3_bind_blob64(stmt, 2, body, len, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, etag, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, last_modified, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 5, time(NULL) + max_age);
+    sqlite3_bind_int64(stmt, 6, g_get_real_time());
+    sqlite3_bind_int64(stmt, 7, size);
+
+    rcode = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+
+    // Replacing an entry overcounts, the next eviction recounts
+    cache->total_bytes += size;
+    http_cache_evict(cache);
+}
+
+void vocagtk_http_cache_refresh(
+    VocagtkHttpCache *cache, char const *url,
+    gint64 max_age
+) {
+    if (!cache->db) return;
+
+    char const *sql =
+        "UPDATE response SET expires_at = ?, accessed_at = ? WHERE url = ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+    sqlite3_bind_int64(stmt, 1, time(NULL) + max_age);
+    sqlite3_bind_int64(stmt, 2, g_get_real_time());
+    sqlite3_bind_text(stmt, 3, url, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) vocagtk_warn_sql_db(cache->db);
+    else cache->revalidated++;
+    sqlite3_finalize(stmt);
+}
@@ -0,0 +1,471 @@
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+#include <string.h>
+
+#include "exterr.h"
+#include "helper.h"
+#include "imagecache.h"
+
+char *vocagtk_image_cache_key(char const *url) {
+    return g_compute_checksum_for_string(G_CHECKSUM_SHA256, url, -1);
+}
+
+static char *image_cache_shard(char const *dir, char const *hash) {
+    return g_strdup_printf("%s/%.2s/%.2s", dir, hash, hash + 2);
+}
+
+char *vocagtk_image_cache_path(
+    VocagtkImageCache const *cache, char const *url
+) {
+    char *hash = vocagtk_image_cache_key(url);
+    char *path = g_strdup_printf(
+        "%s/%.2s/%.2s/%s", cache->dir, hash, hash + 2, hash
+    );
+    g_free(hash);
+    return path;
+}
+
+static void image_cache_sum(VocagtkImageCache *cache) {
+    char const *sql = "SELECT COALESCE(SUM(size), 0) FROM image;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        cache->total_bytes = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+}
+
+// Bytes indexed for hash, 0 if it isn't
+static gint64 image_cache_size_of(VocagtkImageCache *cache, char const *hash) {
+    char const *sql = "SELECT size FROM image WHERE hash = ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return 0;
+    }
+    sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+    gint64 size = 0;
+    rcode = sqlite3_step(stmt);
+    if (rcode == SQLITE_ROW) size = sqlite3_column_int64(stmt, 0);
+    else if (rcode != SQLITE_DONE) vocagtk_warn_sql_db(cache->db);
+    sqlite3_finalize(stmt);
+    return size;
+}
+
+// Write the access times gathered since the last flush in one transaction
+static void image_cache_flush(VocagtkImageCache *cache) {
+    if (!cache->db || !g_hash_table_size(cache->touched)) return;
+
+    char const *sql = "UPDATE image SET accessed_at = ? WHERE hash = ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+    sqlite3_exec(cache->db, "BEGIN;", NULL, NULL, NULL);
+
+    gint64 now = g_get_real_time();
+    GHashTableIter it;
+    gpointer hash;
+    g_hash_table_iter_init(&it, cache->touched);
+    while (g_hash_table_iter_next(&it, &hash, NULL)) {
+        sqlite3_bind_int64(stmt, 1, now);
+        sqlite3_bind_text(stmt, 2, hash, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) vocagtk_warn_sql_db(cache->db);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    if (sqlite3_exec(cache->db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+    }
+    g_hash_table_remove_all(cache->touched);
+}
+
+static gboolean image_cache_flush_timeout(gpointer user_data) {
+    VocagtkImageCache *cache = user_data;
+    cache->flush_id = 0;
+    image_cache_flush(cache);
+    return G_SOURCE_REMOVE;
+}
+
+// Guards busy of every cache, and the removal of an evicted image's files
+// against a download of the same URL starting meanwhile
+G_LOCK_DEFINE_STATIC(image_busy);
+
+typedef struct {
+    char *dir;
+    GPtrArray *hashes; // of the evicted images
+    GHashTable *busy; // of the cache
+    VocagtkImageEvictFunc func;
+    gpointer data;
+} ImageUnlink;
+
+static void image_unlink_free(ImageUnlink *unlink) {
+    g_free(unlink->dir);
+    g_ptr_array_unref(unlink->hashes);
+    g_hash_table_unref(unlink->busy);
+    g_free(unlink);
+}
+
+// Returns true if name is the image of hash or one of its thumbnails,
+// <hash>.<size>.png. Temporary files of downloads never match.
+static bool image_unlink_matches(char const *name, char const *hash) {
+    if (!g_str_has_prefix(name, hash)) return false;
+    char const *suffix = name + strlen(hash);
+    if (!*suffix) return true;
+    if (*suffix++ != '.' || !g_ascii_isdigit(*suffix)) return false;
+    while (g_ascii_isdigit(*suffix)) suffix++;
+    return strcmp(suffix, ".png") == 0;
+}
+
+// Runs on a worker thread, removes the evicted images and their variants.
+// Images downloaded again meanwhile are left alone.
+static void image_unlink_run(
+    GTask *task, gpointer source, gpointer task_data,
+    GCancellable *cancellable
+) {
+    ImageUnlink *unlink = task_data;
+    for (guint i = 0; i < unlink->hashes->len; i++) {
+        char const *hash = g_ptr_array_index(unlink->hashes, i);
+        G_LOCK(image_busy);
+        if (g_hash_table_contains(unlink->busy, hash)) {
+            G_UNLOCK(image_busy);
+            continue;
+        }
+        char *shard = image_cache_shard(unlink->dir, hash);
+        GDir *dir = g_dir_open(shard, 0, NULL);
+        char const *name;
+        while (dir && (name = g_dir_read_name(dir))) {
+            if (!image_unlink_matches(name, hash)) continue;
+            char *path = g_build_filename(shard, name, NULL);
+            g_remove(path);
+            g_free(path);
+        }
+        if (dir) g_dir_close(dir);
+        g_free(shard);
+        G_UNLOCK(image_busy);
+        if (unlink->func) unlink->func(hash, unlink->data);
+    }
+    g_task_return_boolean(task, true);
+}
+
+// Drops the least recently used images in batches while the main loop is
+// idle, down to a tenth below the cap so that every store doesn't evict.
+// The rows go right away, the files are removed on a worker thread.
+static gboolean image_cache_evict(gpointer user_data) {
+    VocagtkImageCache *cache = user_data;
+    gint64 target = cache->max_bytes - cache->max_bytes / 10;
+
+    // Accesses gathered meanwhile decide what goes
+    image_cache_flush(cache);
+
+    char const *sql =
+        "SELECT hash, size FROM image ORDER BY accessed_at, hash LIMIT ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        cache->evict_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    sqlite3_bind_int(stmt, 1, VOCAGTK_IMAGE_CACHE_EVICT_BATCH);
+
+    GPtrArray *hashes = g_ptr_array_new_with_free_func(g_free);
+    gint64 freed = 0;
+    while (
+        cache->total_bytes - freed > target
+        && (rcode = sqlite3_step(stmt)) == SQLITE_ROW
+    ) {
+        g_ptr_array_add(hashes, g_strdup(sqlite3_column_str(stmt, 0)));
+        freed += sqlite3_column_int64(stmt, 1);
+    }
+    if (rcode != SQLITE_ROW && rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(cache->db);
+    }
+    sqlite3_finalize(stmt);
+
+    sql = "DELETE FROM image WHERE hash = ?;";
+    rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        g_ptr_array_unref(hashes);
+        cache->evict_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    sqlite3_exec(cache->db, "BEGIN;", NULL, NULL, NULL);
+    for (guint i = 0; i < hashes->len; i++) {
+        char const *hash = g_ptr_array_index(hashes, i);
+        sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) vocagtk_warn_sql_db(cache->db);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    if (sqlite3_exec(cache->db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+    }
+
+    cache->total_bytes -= freed;
+    cache->evicted += hashes->len;
+    bool done = !hashes->len || cache->total_bytes <= target;
+
+    if (hashes->len) {
+        ImageUnlink *unlink = g_new0(ImageUnlink, 1);
+        unlink->dir = g_strdup(cache->dir);
+        unlink->hashes = hashes;
+        unlink->busy = g_hash_table_ref(cache->busy);
+        unlink->func = cache->evict_func;
+        unlink->data = cache->evict_data;
+        GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+        g_task_set_task_data(task, unlink, (GDestroyNotify) image_unlink_free);
+        g_task_run_in_thread(task, image_unlink_run);
+        g_object_unref(task);
+    } else {
+        g_ptr_array_unref(hashes);
+    }
+
+    if (!done) return G_SOURCE_CONTINUE;
+    DEBUG("Image cache down to %ld bytes", (long) cache->total_bytes);
+    cache->evict_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static void image_cache_schedule_evict(VocagtkImageCache *cache) {
+    if (cache->evict_id || cache->total_bytes <= cache->max_bytes) return;
+    cache->evict_id = g_idle_add_full(
+        G_PRIORITY_LOW, image_cache_evict, cache, NULL
+    );
+}
+
+bool vocagtk_image_cache_open(
+    VocagtkImageCache *cache,
+    char const *dir, gint64 max_bytes
+) {
+    memset(cache, 0, sizeof(*cache));
+    cache->dir = g_strdup(dir);
+    cache->max_bytes = max_bytes;
+    cache->touched = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, NULL
+    );
+    cache->busy = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    g_mkdir_with_parents(dir, 0755);
+    char *index_path = g_build_filename(dir, "index.db", NULL);
+    int rcode = sqlite3_open(index_path, &cache->db);
+    g_free(index_path);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_rcode(rcode);
+        sqlite3_close(cache->db);
+        cache->db = NULL;
+        return false;
+    }
+
+    char const *sqls[] = {
+        // The index can always be rebuilt, trade durability for speed
+        "PRAGMA journal_mode = WAL;",
+        "PRAGMA synchronous = OFF;",
+
+        "CREATE TABLE IF NOT EXISTS image("
+        "hash TEXT PRIMARY KEY, url TEXT,"
+        "size INTEGER, accessed_at INTEGER"
+        ") WITHOUT ROWID;",
+
+        "CREATE INDEX IF NOT EXISTS image_lru ON image(accessed_at);",
+    };
+
+    char *errmsg;
+    for (gsize i = 0; i < G_N_ELEMENTS(sqls); ++i) {
+        if (sqlite3_exec(cache->db, sqls[i], NULL, NULL, &errmsg) != SQLITE_OK) {
+            vocagtk_warn_sql("%s", errmsg);
+            sqlite3_free(errmsg);
+        }
+    }
+
+    image_cache_sum(cache);
+    image_cache_schedule_evict(cache);
+    return true;
+}
+
+void vocagtk_image_cache_close(VocagtkImageCache *cache) {
+    if (cache->flush_id) g_source_remove(cache->flush_id);
+    if (cache->evict_id) g_source_remove(cache->evict_id);
+    if (cache->db) {
+        image_cache_flush(cache);
+        DEBUG(
+            "Image cache: %u hits, %u misses, %u evicted, %ld bytes",
+            cache->hits, cache->misses, cache->evicted,
+            (long) cache->total_bytes
+        );
+        sqlite3_close(cache->db);
+    }
+    g_clear_pointer(&cache->touched, g_hash_table_unref);
+    g_clear_pointer(&cache->busy, g_hash_table_unref);
+    g_free(cache->dir);
+    memset(cache, 0, sizeof(*cache));
+}
+
+void vocagtk_image_cache_set_max_bytes(
+    VocagtkImageCache *cache, gint64 max_bytes
+) {
+    cache->max_bytes = max_bytes;
+    if (cache->db) image_cache_schedule_evict(cache);
+}
+
+bool vocagtk_image_cache_contains(VocagtkImageCache *cache, char const *url) {
+    if (!cache->db) {
+        char *path = vocagtk_image_cache_path(cache, url);
+        bool exists = g_file_test(path, G_FILE_TEST_EXISTS);
+        g_free(path);
+        return exists;
+    }
+
+    char *hash = vocagtk_image_cache_key(url);
+    char const *sql = "SELECT 1 FROM image WHERE hash = ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        g_free(hash);
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+    rcode = sqlite3_step(stmt);
+    if (rcode != SQLITE_ROW && rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(cache->db);
+    }
+    sqlite3_finalize(stmt);
+
+    bool hit = rcode == SQLITE_ROW;
+    if (hit) {
+        cache->hits++;
+        vocagtk_image_cache_touch(cache, url);
+    } else {
+        cache->misses++;
+    }
+    g_free(hash);
+    return hit;
+}
+
+void vocagtk_image_cache_touch(VocagtkImageCache *cache, char const *url) {
+    if (!cache->db) return;
+    g_hash_table_add(cache->touched, vocagtk_image_cache_key(url));
+    if (!cache->flush_id) {
+        cache->flush_id = g_timeout_add_seconds(
+            VOCAGTK_IMAGE_CACHE_FLUSH, image_cache_flush_timeout, cache
+        );
+    }
+}
+
+void vocagtk_image_cache_add(
+    VocagtkImageCache *cache, char const *url, gint64 bytes
+) {
+    if (!cache->db) return;
+
+    char *hash = vocagtk_image_cache_key(url);
+    gint64 old_size = image_cache_size_of(cache, hash);
+
+    char const *sql =
+        "INSERT INTO image(hash, url, size, accessed_at) VALUES(?, ?, ?, ?) "
+        "ON CONFLICT(hash) DO UPDATE SET "
+        "size = excluded.size, "
+        "accessed_at = excluded.accessed_at;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        g_free(hash);
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, url, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, bytes);
+    sqlite3_bind_int64(stmt, 4, g_get_real_time());
+
+    rcode = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    g_free(hash);
+    if (rcode != SQLITE_DONE) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+
+    cache->total_bytes += bytes - old_size;
+    image_cache_schedule_evict(cache);
+}
+
+void vocagtk_image_cache_grow(
+    VocagtkImageCache *cache, char const *url, gint64 bytes
+) {
+    if (!cache->db) return;
+
+    char const *sql = "UPDATE image SET size = size + ? WHERE hash = ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        return;
+    }
+    char *hash = vocagtk_image_cache_key(url);
+    sqlite3_bind_int64(stmt, 1, bytes);
+    sqlite3_bind_text(stmt, 2, hash, -1, SQLITE_STATIC);
+
+    rcode = sqlite3_step(stmt);
+    if (rcode != SQLITE_DONE) vocagtk_warn_sql_db(cache->db);
+    else if (sqlite3_changes(cache->db)) cache->total_bytes += bytes;
+    sqlite3_finalize(stmt);
+    g_free(hash);
+
+    image_cache_schedule_evict(cache);
+}
+
+void vocagtk_image_cache_forget(VocagtkImageCache *cache, char const *url) {
+    if (!cache->db) return;
+
+    char *hash = vocagtk_image_cache_key(url);
+    gint64 size = image_cache_size_of(cache, hash);
+    g_hash_table_remove(cache->touched, hash);
+
+    char const *sql = "DELETE FROM image WHERE hash = ?;";
+    sqlite3_stmt *stmt;
+    int rcode = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    if (rcode != SQLITE_OK) {
+        vocagtk_warn_sql_db(cache->db);
+        g_free(hash);
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) != SQLITE_DONE) vocagtk_warn_sql_db(cache->db);
+    else cache->total_bytes -= size;
+    sqlite3_finalize(stmt);
+    g_free(hash);
+}
+
+void vocagtk_image_cache_hold(VocagtkImageCache *cache, char const *url) {
+    char *hash = vocagtk_image_cache_key(url);
+    G_LOCK(image_busy);
+    guint count = GPOINTER_TO_UINT(g_hash_table_lookup(cache->busy, hash));
+    g_hash_table_insert(cache->busy, hash, GUINT_TO_POINTER(count + 1));
+    G_UNLOCK(image_busy);
+}
+
+void vocagtk_image_cache_release(VocagtkImageCache *cache, char const *url) {
+    char *hash = vocagtk_image_cache_key(url);
+    G_LOCK(image_busy);
+    guint count = GPOINTER_TO_UINT(g_hash_table_lookup(cache->busy, hash));
+    if (count > 1) {
+        g_hash_table_insert(cache->busy, hash, GUINT_TO_POINTER(count - 1));
+        hash = NULL;
+    } else {
+        g_hash_table_remove(cache->busy, hash);
+    }
+    G_UNLOCK(image_busy);
+    g_free(hash);
+}
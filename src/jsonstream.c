@@ -0,0 +1,150 @@
+#include <glib.h>
+#include <string.h>
+#include <yyjson.h>
+
+#include "exterr.h"
+#include "jsonstream.h"
+
+enum {
+    SINK_DROP, // separators between elements
+    SINK_ENVELOPE,
+    SINK_ELEM,
+};
+
+void vocagtk_json_stream_init(VocagtkJsonStream *stream) {
+    memset(stream, 0, sizeof(*stream));
+    stream->envelope = g_byte_array_new();
+    stream->elem = g_byte_array_new();
+    stream->key = g_string_new(NULL);
+    g_queue_init(&stream->items);
+}
+
+void vocagtk_json_stream_clear(VocagtkJsonStream *stream) {
+    if (!stream->envelope) return;
+    g_byte_array_free(stream->envelope, true);
+    g_byte_array_free(stream->elem, true);
+    g_string_free(stream->key, true);
+    g_queue_clear_full(&stream->items, (GDestroyNotify) yyjson_doc_free);
+    memset(stream, 0, sizeof(*stream));
+}
+
+static int stream_sink(VocagtkJsonStream const *stream) {
+    if (!stream->items_depth) return SINK_ENVELOPE;
+    return stream->depth > stream->items_depth ? SINK_ELEM : SINK_DROP;
+}
+
+static void stream_flush(
+    VocagtkJsonStream *stream, int sink,
+    char const *data, size_t from, size_t to
+) {
+    if (to <= from) return;
+    guint8 const *p = (guint8 const *) data + from;
+    switch (sink) {
+    case SINK_ENVELOPE:
+        g_byte_array_append(stream->envelope, p, to - from);
+        break;
+    case SINK_ELEM:
+        g_byte_array_append(stream->elem, p, to - from);
+        break;
+    default:
+        break;
+    }
+}
+
+static void stream_push_elem(VocagtkJsonStream *stream) {
+    stream->n_items++;
+    yyjson_doc *doc = yyjson_read(
+        (char *) stream->elem->data, stream->elem->len,
+        YYJSON_READ_NOFLAG
+    );
+    if (doc) g_queue_push_tail(&stream->items, doc);
+    else vocagtk_warn_def("Dropped malformed item of %u bytes", stream->elem->len);
+    g_byte_array_set_size(stream->elem, 0);
+}
+
+void vocagtk_json_stream_feed(
+    VocagtkJsonStream *stream,
+    char const *data, size_t len
+) {
+    stream->received += len;
+
+    // Bytes are copied in runs going to the same sink
+    size_t run = 0;
+    int run_sink = stream_sink(stream);
+
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        int sink = SINK_DROP;
+        bool elem_done = false;
+
+        if (stream->in_string) {
+            sink = stream_sink(stream);
+            if (stream->escape) stream->escape = false;
+            else if (c == '\\') stream->escape = true;
+            else if (c == '"') stream->in_string = false;
+
+            if (stream->in_string && stream->depth == 1) {
+                g_string_append_c(stream->key, c);
+            }
+        } else switch (c) {
+        case '"':
+            stream->in_string = true;
+            if (stream->depth == 1) g_string_truncate(stream->key, 0);
+            sink = stream_sink(stream);
+            break;
+        case '{':
+        case '[':
+            stream->depth++;
+            if (
+                c == '[' && stream->depth == 2 && !stream->items_depth
+                && strcmp(stream->key->str, "items") == 0
+            ) {
+                stream->items_depth = stream->depth;
+                sink = SINK_ENVELOPE;
+            } else {
+                sink = stream_sink(stream);
+            }
+            break;
+        case '}':
+        case ']':
+            if (stream->items_depth && stream->depth == stream->items_depth) {
+                // The items array itself is closed
+                stream->items_depth = 0;
+                stream->depth--;
+                sink = SINK_ENVELOPE;
+                break;
+            }
+            sink = stream_sink(stream);
+            stream->depth--;
+            elem_done = stream->items_depth
+                && stream->depth == stream->items_depth;
+            break;
+        default:
+            sink = stream_sink(stream);
+            break;
+        }
+
+        if (sink != run_sink) {
+            stream_flush(stream, run_sink, data, run, i);
+            run = i;
+            run_sink = sink;
+        }
+        if (elem_done) {
+            stream_flush(stream, run_sink, data, run, i + 1);
+            run = i + 1;
+            stream_push_elem(stream);
+        }
+    }
+    stream_flush(stream, run_sink, data, run, len);
+}
+
+yyjson_doc *vocagtk_json_stream_pop(VocagtkJsonStream *stream) {
+    return g_queue_pop_head(&stream->items);
+}
+
+yyjson_doc *vocagtk_json_stream_envelope(VocagtkJsonStream *stream) {
+    return yyjson_read(
+        (char *) stream->envelope->data, stream->envelope->len,
+        YYJSON_READ_NOFLAG
+    );
+}
@@ -0,0 +1,472 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "exterr.h"
+#include "helper.h"
+#include "pack.h"
+
+// Written both to the index and in front of every blob in the data file,
+// a lookup only trusts a blob whose header matches its index record.
+typedef struct {
+    char key[64]; // NUL padded, fits a hex SHA-256
+    gint32 size; // -1 in the index removes every size of key
+    guint32 len;
+    guint64 offset; // of this header in the data file
+} PackRecord;
+
+typedef struct {
+    int size;
+    guint32 len;
+    guint64 offset;
+} PackBlob;
+
+static GHashTable *pack_entries_new(void) {
+    return g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_array_unref
+    );
+}
+
+static PackBlob *pack_find(GHashTable *entries, char const *key, int size) {
+    GArray *blobs = g_hash_table_lookup(entries, key);
+    if (!blobs) return NULL;
+    for (guint i = 0; i < blobs->len; i++) {
+        PackBlob *blob = &g_array_index(blobs, PackBlob, i);
+        if (blob->size == size) return blob;
+    }
+    return NULL;
+}
+
+static void pack_set(
+    GHashTable *entries, guint64 *live,
+    char const *key, PackBlob const *blob
+) {
+    PackBlob *old = pack_find(entries, key, blob->size);
+    if (old) {
+        *live -= sizeof(PackRecord) + old->len;
+        *old = *blob;
+    } else {
+        GArray *blobs = g_hash_table_lookup(entries, key);
+        if (!blobs) {
+            blobs = g_array_new(false, false, sizeof(PackBlob));
+            g_hash_table_insert(entries, g_strdup(key), blobs);
+        }
+        g_array_append_val(blobs, *blob);
+    }
+    *live += sizeof(PackRecord) + blob->len;
+}
+
+static void pack_drop(GHashTable *entries, guint64 *live, char const *key) {
+    GArray *blobs = g_hash_table_lookup(entries, key);
+    if (!blobs) return;
+    for (guint i = 0; i < blobs->len; i++) {
+        *live -= sizeof(PackRecord) + g_array_index(blobs, PackBlob, i).len;
+    }
+    g_hash_table_remove(entries, key);
+}
+
+static void pack_record_init(
+    PackRecord *rec, char const *key, int size,
+    guint32 len, guint64 offset
+) {
+    memset(rec, 0, sizeof(*rec));
+    strncpy(rec->key, key, sizeof(rec->key));
+    rec->size = size;
+    rec->len = len;
+    rec->offset = offset;
+}
+
+static bool pack_write(int fd, void const *data, gsize len, guint64 offset) {
+    guint8 const *p = data;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Called with the lock held, makes the mapping cover end bytes
+static bool pack_map(VocagtkPack *pack, guint64 end) {
+    if (pack->map && g_mapped_file_get_length(pack->map) >= end) return true;
+
+    GError *error = NULL;
+    GMappedFile *map = g_mapped_file_new(pack->data_path, false, &error);
+    if (!map) {
+        vocagtk_warn_def(
+            "Failed to map %s: %s", pack->data_path, error->message
+        );
+        g_error_free(error);
+        return false;
+    }
+    // Slices of the old mapping keep it alive
+    if (pack->map) g_mapped_file_unref(pack->map);
+    pack->map = map;
+    return g_mapped_file_get_length(map) >= end;
+}
+
+// Read every index record, later ones win. Records pointing past the data
+// file or at a torn tail are dropped.
+static void pack_load_index(VocagtkPack *pack) {
+    char *contents = NULL;
+    gsize len = 0;
+    if (!g_file_get_contents(pack->index_path, &contents, &len, NULL)) return;
+
+    gsize n = len / sizeof(PackRecord);
+    for (gsize i = 0; i < n; i++) {
+        PackRecord rec;
+        memcpy(&rec, contents + i * sizeof(rec), sizeof(rec));
+        char *key = g_strndup(rec.key, sizeof(rec.key));
+        if (rec.size < 0) {
+            pack_drop(pack->entries, &pack->live_bytes, key);
+        } else if (rec.offset + sizeof(rec) + rec.len <= pack->data_end) {
+            PackBlob blob = {rec.size, rec.len, rec.offset};
+            pack_set(pack->entries, &pack->live_bytes, key, &blob);
+        }
+        g_free(key);
+    }
+    g_free(contents);
+
+    gsize whole = n * sizeof(PackRecord);
+    if (len != whole && truncate(pack->index_path, whole) != 0) {
+        vocagtk_warn_def("Failed to truncate %s", pack->index_path);
+    }
+}
+
+static bool pack_open_files(VocagtkPack *pack) {
+    pack->data_fd = g_open(pack->data_path, O_RDWR | O_CREAT, 0644);
+    if (pack->data_fd < 0) {
+        vocagtk_warn_def("Failed to open %s", pack->data_path);
+        return false;
+    }
+    pack->index = g_fopen(pack->index_path, "ab");
+    if (!pack->index) {
+        vocagtk_warn_def("Failed to open %s", pack->index_path);
+        g_close(pack->data_fd, NULL);
+        pack->data_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool vocagtk_pack_open(VocagtkPack *pack, char const *dir, char const *name) {
+    g_mutex_lock(&pack->lock);
+    char *data_name = g_strconcat(name, ".pack", NULL);
+    char *index_name = g_strconcat(name, ".idx", NULL);
+    pack->data_path = g_build_filename(dir, data_name, NULL);
+    pack->index_path = g_build_filename(dir, index_name, NULL);
+    g_free(data_name);
+    g_free(index_name);
+
+    g_mkdir_with_parents(dir, 0755);
+    if (!pack_open_files(pack)) {
+        g_clear_pointer(&pack->data_path, g_free);
+        g_clear_pointer(&pack->index_path, g_free);
+        g_mutex_unlock(&pack->lock);
+        return false;
+    }
+    pack->data_end = lseek(pack->data_fd, 0, SEEK_END);
+    pack->live_bytes = 0;
+    pack->entries = pack_entries_new();
+    pack_load_index(pack);
+
+    DEBUG(
+        "Opened %s, %u keys in %ld live of %ld bytes",
+        pack->data_path, g_hash_table_size(pack->entries),
+        (long) pack->live_bytes, (long) pack->data_end
+    );
+    g_mutex_unlock(&pack->lock);
+    return true;
+}
+
+void vocagtk_pack_close(VocagtkPack *pack) {
+    g_mutex_lock(&pack->lock);
+    while (pack->compacting) g_cond_wait(&pack->compacted, &pack->lock);
+    // A compaction failing to reopen the files left them closed already
+    if (pack->data_path) {
+        if (pack->data_fd >= 0) g_close(pack->data_fd, NULL);
+        if (pack->index) fclose(pack->index);
+    }
+    pack->data_fd = -1;
+    pack->index = NULL;
+    g_clear_pointer(&pack->map, g_mapped_file_unref);
+    g_clear_pointer(&pack->entries, g_hash_table_unref);
+    g_clear_pointer(&pack->data_path, g_free);
+    g_clear_pointer(&pack->index_path, g_free);
+    g_mutex_unlock(&pack->lock);
+}
+
+GBytes *vocagtk_pack_lookup(VocagtkPack *pack, char const *key, int size) {
+    GBytes *slice = NULL;
+    g_mutex_lock(&pack->lock);
+    PackBlob *blob = pack->entries ? pack_find(pack->entries, key, size) : NULL;
+    if (blob && pack_map(pack, blob->offset + sizeof(PackRecord) + blob->len)) {
+        guint8 const *data =
+            (guint8 const *) g_mapped_file_get_contents(pack->map);
+        PackRecord rec;
+        pack_record_init(&rec, key, size, blob->len, blob->offset);
+        if (memcmp(data + blob->offset, &rec, sizeof(rec)) == 0) {
+            GBytes *whole = g_mapped_file_get_bytes(pack->map);
+            slice = g_bytes_new_from_bytes(
+                whole, blob->offset + sizeof(rec), blob->len
+            );
+            g_bytes_unref(whole);
+        } else {
+            vocagtk_warn_def("Dropped mismatched blob of %s", key);
+            pack_drop(pack->entries, &pack->live_bytes, key);
+        }
+    }
+    g_mutex_unlock(&pack->lock);
+    return slice;
+}
+
+static void pack_compact_run(
+    GTask *task, gpointer source, gpointer task_data,
+    GCancellable *cancellable
+);
+
+// Called with the lock held
+static void pack_maybe_compact(VocagtkPack *pack) {
+    guint64 dead = pack->data_end - pack->live_bytes;
+    if (pack->compacting) return;
+    if (dead < VOCAGTK_PACK_COMPACT_MIN || dead <= pack->live_bytes) return;
+
+    pack->compacting = true;
+    GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+    g_task_set_task_data(task, pack, NULL);
+    g_task_run_in_thread(task, pack_compact_run);
+    g_object_unref(task);
+}
+
+bool vocagtk_pack_store(
+    VocagtkPack *pack, char const *key, int size,
+    void const *data, gsize len
+) {
+    if (size < 0 || strlen(key) > sizeof(((PackRecord *) NULL)->key)) {
+        return false;
+    }
+
+    g_mutex_lock(&pack->lock);
+    if (!pack->entries) {
+        g_mutex_unlock(&pack->lock);
+        return false;
+    }
+
+    PackRecord rec;
+    pack_record_init(&rec, key, size, len, pack->data_end);
+    guint64 end = pack->data_end + sizeof(rec) + len;
+    // The blob goes first, its index record only once it is complete
+    bool ok = pack_write(pack->data_fd, &rec, sizeof(rec), rec.offset)
+        && pack_write(pack->data_fd, data, len, rec.offset + sizeof(rec))
+        && fwrite(&rec, sizeof(rec), 1, pack->index) == 1
+        && fflush(pack->index) == 0;
+    // A failed append leaves dead bytes behind at most
+    pack->data_end = end;
+    if (ok) {
+        PackBlob blob = {size, len, rec.offset};
+        pack_set(pack->entries, &pack->live_bytes, key, &blob);
+    } else {
+        vocagtk_warn_def("Failed to append %s to %s", key, pack->data_path);
+    }
+    pack_maybe_compact(pack);
+    g_mutex_unlock(&pack->lock);
+    return ok;
+}
+
+void vocagtk_pack_remove(VocagtkPack *pack, char const *key) {
+    g_mutex_lock(&pack->lock);
+    if (pack->entries && g_hash_table_contains(pack->entries, key)) {
+        PackRecord rec;
+        pack_record_init(&rec, key, -1, 0, 0);
+        bool ok = fwrite(&rec, sizeof(rec), 1, pack->index) == 1
+            && fflush(pack->index) == 0;
+        if (!ok) {
+            vocagtk_warn_def(
+                "Failed to remove %s from %s", key, pack->index_path
+            );
+        }
+        pack_drop(pack->entries, &pack->live_bytes, key);
+        pack_maybe_compact(pack);
+    }
+    g_mutex_unlock(&pack->lock);
+}
+
+typedef struct {
+    char *key;
+    PackBlob blob; // in the old data file
+    guint64 offset; // in the new one
+} PackCopy;
+
+// Copy a blob with its header from the old mapping to offset in fd
+static bool pack_copy(
+    int fd, guint8 const *data,
+    char const *key, PackBlob const *blob, guint64 offset
+) {
+    PackRecord rec;
+    pack_record_init(&rec, key, blob->size, blob->len, offset);
+    return pack_write(fd, &rec, sizeof(rec), offset)
+        && pack_write(
+            fd, data + blob->offset + sizeof(rec), blob->len,
+            offset + sizeof(rec)
+        );
+}
+
+static void pack_index_append(
+    GByteArray *index, char const *key,
+    PackBlob const *blob
+) {
+    PackRecord rec;
+    pack_record_init(&rec, key, blob->size, blob->len, blob->offset);
+    g_byte_array_append(index, (guint8 const *) &rec, sizeof(rec));
+}
+
+// Runs on a worker thread. Live blobs are copied into a new data file
+// without the lock, blobs stored or removed meanwhile are reconciled with
+// it held before both files are swapped in.
+static void pack_compact_run(
+    GTask *task, gpointer source, gpointer task_data,
+    GCancellable *cancellable
+) {
+    VocagtkPack *pack = task_data;
+
+    g_mutex_lock(&pack->lock);
+    GArray *copies = g_array_new(false, false, sizeof(PackCopy));
+    GHashTableIter it;
+    gpointer key, value;
+    g_hash_table_iter_init(&it, pack->entries);
+    while (g_hash_table_iter_next(&it, &key, &value)) {
+        GArray *blobs = value;
+        for (guint i = 0; i < blobs->len; i++) {
+            PackCopy copy = {
+                g_strdup(key), g_array_index(blobs, PackBlob, i), 0
+            };
+            g_array_append_val(copies, copy);
+        }
+    }
+    guint64 snapshot_end = pack->data_end;
+    GMappedFile *map = pack_map(pack, snapshot_end)
+        ? g_mapped_file_ref(pack->map) : NULL;
+    char *tmp_data_path = g_strconcat(pack->data_path, ".tmp", NULL);
+    char *tmp_index_path = g_strconcat(pack->index_path, ".tmp", NULL);
+    g_mutex_unlock(&pack->lock);
+
+    int fd = -1;
+    if (map) fd = g_open(tmp_data_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+    guint64 end = 0;
+    for (guint i = 0; ok && i < copies->len; i++) {
+        PackCopy *copy = &g_array_index(copies, PackCopy, i);
+        guint8 const *data = (guint8 const *) g_mapped_file_get_contents(map);
+        copy->offset = end;
+        ok = pack_copy(fd, data, copy->key, &copy->blob, end);
+        end += sizeof(PackRecord) + copy->blob.len;
+    }
+
+    g_mutex_lock(&pack->lock);
+    GHashTable *entries = pack_entries_new();
+    guint64 live = 0;
+    GByteArray *index = g_byte_array_new();
+
+    // Keep the copies still current, append what was stored meanwhile
+    for (guint i = 0; ok && i < copies->len; i++) {
+        PackCopy *copy = &g_array_index(copies, PackCopy, i);
+        PackBlob *now = pack_find(pack->entries, copy->key, copy->blob.size);
+        if (!now || now->offset != copy->blob.offset) continue;
+        PackBlob blob = {copy->blob.size, copy->blob.len, copy->offset};
+        pack_set(entries, &live, copy->key, &blob);
+        pack_index_append(index, copy->key, &blob);
+    }
+    if (ok && pack->data_end > snapshot_end) {
+        ok = pack_map(pack, pack->data_end);
+        g_hash_table_iter_init(&it, pack->entries);
+        while (ok && g_hash_table_iter_next(&it, &key, &value)) {
+            GArray *blobs = value;
+            guint8 const *data =
+                (guint8 const *) g_mapped_file_get_contents(pack->map);
+            for (guint i = 0; ok && i < blobs->len; i++) {
+                PackBlob *now = &g_array_index(blobs, PackBlob, i);
+                if (now->offset < snapshot_end) continue;
+                ok = pack_copy(fd, data, key, now, end);
+                PackBlob blob = {now->size, now->len, end};
+                pack_set(entries, &live, key, &blob);
+                pack_index_append(index, key, &blob);
+                end += sizeof(PackRecord) + now->len;
+            }
+        }
+    }
+
+    GError *error = NULL;
+    ok = ok && g_file_set_contents_full(
+        tmp_index_path, (char const *) index->data, index->len,
+        G_FILE_SET_CONTENTS_CONSISTENT, 0644, &error
+    );
+    if (ok) {
+        fclose(pack->index);
+        g_close(pack->data_fd, NULL);
+        // Swapped data file first. The old index, left over by a crash or a
+        // failed rename, then points at headers which don't match and only
+        // costs those blobs, never at the wrong bytes.
+        ok = g_rename(tmp_data_path, pack->data_path) == 0;
+        if (ok && g_rename(tmp_index_path, pack->index_path) != 0) {
+            // The new data file is in, rewrite the index in place
+            FILE *f = g_fopen(pack->index_path, "wb");
+            bool written = f
+                && fwrite(index->data, 1, index->len, f) == index->len;
+            if (f && fclose(f) != 0) written = false;
+            if (!written) {
+                vocagtk_warn_def("Failed to replace %s", pack->index_path);
+            }
+        }
+        if (ok) {
+            DEBUG(
+                "Compacted %s from %ld to %ld bytes", pack->data_path,
+                (long) pack->data_end, (long) end
+            );
+            g_clear_pointer(&pack->map, g_mapped_file_unref);
+            g_hash_table_unref(pack->entries);
+            pack->entries = entries;
+            pack->live_bytes = live;
+            pack->data_end = end;
+            entries = NULL;
+        } else {
+            vocagtk_warn_def("Failed to replace %s", pack->data_path);
+        }
+        if (!pack_open_files(pack)) {
+            // Acts as closed from now on
+            g_clear_pointer(&pack->entries, g_hash_table_unref);
+        }
+    } else {
+        vocagtk_warn_def(
+            "Failed to compact %s: %s", pack->data_path,
+            error ? error->message : "write failed"
+        );
+        g_clear_error(&error);
+    }
+
+    pack->compacting = false;
+    g_cond_broadcast(&pack->compacted);
+    g_mutex_unlock(&pack->lock);
+
+    if (fd >= 0) g_close(fd, NULL);
+    g_remove(tmp_data_path);
+    g_remove(tmp_index_path);
+    g_free(tmp_data_path);
+    g_free(tmp_index_path);
+    if (entries) g_hash_table_unref(entries);
+    g_byte_array_unref(index);
+    for (guint i = 0; i < copies->len; i++) {
+        g_free(g_array_index(copies, PackCopy, i).key);
+    }
+    g_array_unref(copies);
+    if (map) g_mapped_file_unref(map);
+    g_task_return_boolean(task, ok);
+}
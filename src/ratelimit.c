@@ -0,0 +1,71 @@
+#include <glib.h>
+#include <string.h>
+
+#include "exterr.h"
+#include "helper.h"
+#include "ratelimit.h"
+
+void vocagtk_rate_limiter_init(VocagtkRateLimiter *rl) {
+    memset(rl, 0, sizeof(*rl));
+    rl->rate = VOCAGTK_RATE_INITIAL;
+    rl->tokens = VOCAGTK_RATE_BURST;
+    rl->refilled_at = g_get_monotonic_time();
+    rl->window = VOCAGTK_RATE_WINDOW_INITIAL;
+}
+
+static void rate_limiter_refill(VocagtkRateLimiter *rl, gint64 now) {
+    double elapsed = (double) (now - rl->refilled_at) / G_USEC_PER_SEC;
+    rl->tokens = MIN(VOCAGTK_RATE_BURST, rl->tokens + elapsed * rl->rate);
+    rl->refilled_at = now;
+}
+
+gint64 vocagtk_rate_limiter_acquire(VocagtkRateLimiter *rl, bool windowed) {
+    gint64 now = g_get_monotonic_time();
+    if (now < rl->blocked_until) return rl->blocked_until - now;
+    if (windowed && rl->in_flight >= (guint) rl->window) return -1;
+
+    rate_limiter_refill(rl, now);
+    if (rl->tokens < 1.0) {
+        return (gint64) ((1.0 - rl->tokens) / rl->rate * G_USEC_PER_SEC) + 1;
+    }
+
+    rl->tokens -= 1.0;
+    if (windowed) rl->in_flight++;
+    return 0;
+}
+
+void vocagtk_rate_limiter_release(
+    VocagtkRateLimiter *rl, bool windowed,
+    VocagtkRateFeedback feedback, gint64 retry_after
+) {
+    if (windowed && rl->in_flight > 0) rl->in_flight--;
+    gint64 now = g_get_monotonic_time();
+
+    switch (feedback) {
+    case VOCAGTK_RATE_OK:
+        // About one more slot per window of answers, the rate likewise
+        rl->window = MIN(VOCAGTK_RATE_WINDOW_MAX, rl->window + 1.0 / rl->window);
+        rl->rate = MIN(VOCAGTK_RATE_MAX, rl->rate + 0.5 / rl->rate);
+        break;
+    case VOCAGTK_RATE_THROTTLED:
+        rl->throttled++;
+        if (retry_after > 0) {
+            rl->blocked_until = MAX(
+                rl->blocked_until, now + retry_after * G_USEC_PER_SEC
+            );
+        }
+        // Requests sent before the first decrease are answered alike
+        if (now - rl->decreased_at < G_USEC_PER_SEC) break;
+        rl->decreased_at = now;
+        rl->window = MAX(1.0, rl->window / 2);
+        rl->rate = MAX(VOCAGTK_RATE_MIN, rl->rate / 2);
+        rl->tokens = 0;
+        DEBUG(
+            "Throttled, slowing down to %.1f requests/s, %.0f at once",
+            rl->rate, rl->window
+        );
+        break;
+    default:
+        break;
+    }
+}
@@ -151,7 +151,7 @@ VocagtkSong *vocagtk_song_new(VocagtkSongId id, AppState *ctx) {
 
     // 2) Not in DB: fetch from remote.
     CURLcode curl_err = CURLE_OK;
-    yyjson_doc *doc = vocagtk_downloader_song(&ctx->dl, id);
+    yyjson_doc *doc = vocagtk_downloader_song(&ctx->dl, id, NULL, 0);
     if (!doc) {
         // Network or parse error already logged by downloader.
         return g_object_new(VOCAGTK_TYPE_SONG, "id", id, NULL);
@@ -176,6 +176,31 @@ VocagtkSong *vocagtk_song_new(VocagtkSongId id, AppState *ctx) {
     return song;
 }
 
+static gpointer song_from_json(yyjson_val *json) {
+    return json_to_song(json);
+}
+
+void vocagtk_song_new_many_async(
+    VocagtkSongId const *ids, gsize n,
+    AppState *ctx, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    static DbLoadManyFuncs const funcs = {
+        .get_by_ids = db_song_get_by_ids,
+        .fetch_async = vocagtk_downloader_songs_async,
+        .from_json = song_from_json,
+        .store = db_song_store_from_json,
+    };
+    db_load_many_async(
+        ctx->db, &ctx->dl, &funcs, (int const *) ids, n,
+        cancellable, callback, user_data
+    );
+}
+
+GPtrArray *vocagtk_song_new_many_finish(GAsyncResult *res, GError **error) {
+    return db_load_many_finish(res, error);
+}
+
 VocagtkSongId vocagtk_song_get_id(VocagtkSong *self) {
     return self->id;
 }
@@ -0,0 +1,456 @@
+#include <gio/gio.h>
+#include <glib.h>
+#include <string.h>
+#include <time.h>
+
+#include "exterr.h"
+#include "helper.h"
+#include "sync.h"
+
+void vocagtk_sync_artist_begin(
+    VocagtkSyncArtist *sa, sqlite3 *db, VocagtkArtist *artist,
+    bool own_transaction,
+    VocagtkResultIterator *iter
+) {
+    int artist_id = vocagtk_artist_get_id(artist);
+    time_t last_update = vocagtk_artist_get_update_at(artist);
+
+    DEBUG("Updating artist %d, last update at %ld", artist_id, last_update);
+
+    memset(sa, 0, sizeof(*sa));
+    sa->db = db;
+    sa->artist = artist;
+    sa->own_transaction = own_transaction;
+    sa->cp = (DbSyncCheckpoint) {
+        .since = last_update,
+        .next_start = 0,
+        .newest = last_update,
+        .last_song_id = -1,
+    };
+
+    DbSyncCheckpoint saved;
+    int found = db_sync_get(db, artist_id, &saved);
+    if (found == SQLITE_ROW && saved.since == last_update) {
+        sa->cp = saved;
+        DEBUG(
+            "Resuming update of artist %d at %zu",
+            artist_id, sa->cp.next_start
+        );
+        vocagtk_downloader_update_resume(
+            artist_id, last_update,
+            sa->cp.newest > last_update ? sa->cp.newest + 1 : 0,
+            sa->cp.next_start, iter
+        );
+    } else {
+        vocagtk_downloader_update(artist_id, last_update, iter);
+    }
+
+    sa->page = sa->cp.next_start;
+    sa->resumed = sa->cp.last_song_id >= 0;
+}
+
+// Write the songs held for the page, and the checkpoint after it if there
+// is one, all or nothing. Without a transaction of the caller the
+// savepoint is one of its own. The ids stored only join sa->seen once the
+// savepoint is released.
+static bool sync_artist_store_page(VocagtkSyncArtist *sa, bool checkpoint) {
+    yyjson_doc *page = NULL;
+    if (sa->held) {
+        page = yyjson_mut_doc_imut_copy(sa->held, NULL);
+        g_clear_pointer(&sa->held, yyjson_mut_doc_free);
+    }
+
+    if (db_savepoint(sa->db, "sync_page") != SQLITE_OK) {
+        yyjson_doc_free(page);
+        return false;
+    }
+    bool ok = true;
+    GArray *stored = g_array_new(FALSE, FALSE, sizeof(int));
+    size_t skipped = 0;
+
+    size_t idx, max;
+    yyjson_val *song_json;
+    yyjson_arr_foreach(yyjson_doc_get_root(page), idx, max, song_json) {
+        // Collaborations show up in the feed of every artist who worked on
+        // them, the first one stored the relations to all of them already
+        int song_id = yyjson_get_int(yyjson_obj_get(song_json, "id"));
+        if (sa->seen && g_hash_table_contains(sa->seen, GINT_TO_POINTER(song_id))) {
+            skipped++;
+            continue;
+        }
+        if (db_song_store_from_json(sa->db, song_json) != SQLITE_OK) {
+            ok = false;
+            break;
+        }
+        g_array_append_val(stored, song_id);
+    }
+    yyjson_doc_free(page);
+
+    int artist_id = vocagtk_artist_get_id(sa->artist);
+    if (ok && checkpoint) {
+        ok = db_sync_save(sa->db, artist_id, &sa->cp) == SQLITE_OK;
+    }
+    if (ok) ok = db_release(sa->db, "sync_page") == SQLITE_OK;
+    else db_rollback_to(sa->db, "sync_page");
+
+    if (ok) {
+        for (guint i = 0; sa->seen && i < stored->len; i++) {
+            g_hash_table_add(
+                sa->seen, GINT_TO_POINTER(g_array_index(stored, int, i))
+            );
+        }
+        sa->songs += stored->len;
+        sa->skipped += skipped;
+        // Nothing new for this artist, the rest was stored by another one
+        sa->known = skipped > 0 && stored->len == 0;
+    }
+    g_array_free(stored, TRUE);
+    return ok;
+}
+
+bool vocagtk_sync_artist_item(
+    VocagtkSyncArtist *sa, VocagtkResultIterator const *iter,
+    yyjson_val *song_json
+) {
+    // Later pages can't be checkpointed past one which is missing
+    if (sa->broken) return false;
+    if (iter->item_page != sa->page) {
+        // The previous page is complete
+        sa->page = iter->item_page;
+        sa->cp.next_start = sa->page;
+        if (!sync_artist_store_page(sa, true)) {
+            sa->broken = true;
+            return false;
+        }
+        if (sa->known) {
+            DEBUG(
+                "Artist %d: page before %zu known already, stopped",
+                vocagtk_artist_get_id(sa->artist), sa->page
+            );
+            return false;
+        }
+    }
+
+    int song_id = yyjson_get_int(yyjson_obj_get(song_json, "id"));
+    // Already stored right before the update was interrupted
+    if (sa->resumed && song_id == sa->cp.last_song_id) return true;
+    sa->resumed = false;
+
+    // Newest publish date seen, the next update starts after it
+    time_t publish_date = parse_iso8601_datetime(
+        yyjson_get_str(yyjson_obj_get(song_json, "publishDate"))
+    );
+    if (publish_date > sa->cp.newest) sa->cp.newest = publish_date;
+    sa->cp.last_song_id = song_id;
+
+    // The value is only valid until the next item, keep a copy
+    if (!sa->held) {
+        sa->held = yyjson_mut_doc_new(NULL);
+        yyjson_mut_doc_set_root(sa->held, yyjson_mut_arr(sa->held));
+    }
+    yyjson_mut_arr_append(
+        yyjson_mut_doc_get_root(sa->held),
+        yyjson_val_mut_copy(sa->held, song_json)
+    );
+    return true;
+}
+
+bool vocagtk_sync_artist_end(VocagtkSyncArtist *sa, bool ok) {
+    // Songs are sorted newest first, after a failure older ones may still
+    // be missing, so the mark only moves once the update went through.
+    // The page which failed is fetched again next time.
+    int artist_id = vocagtk_artist_get_id(sa->artist);
+    if (!ok || sa->broken) {
+        // The songs of the failed page are dropped unwritten
+        g_clear_pointer(&sa->held, yyjson_mut_doc_free);
+        db_rss_set_polled(sa->db, artist_id, time(NULL));
+        return false;
+    }
+    if (sa->own_transaction) db_begin(sa->db);
+    if (!sync_artist_store_page(sa, false)) {
+        if (sa->own_transaction) db_rollback(sa->db);
+        db_rss_set_polled(sa->db, artist_id, time(NULL));
+        return false;
+    }
+
+    if (sa->skipped) {
+        DEBUG(
+            "Artist %d: %zu songs stored, %zu shared with other artists",
+            artist_id, sa->songs, sa->skipped
+        );
+    }
+    time_t last_update = sa->cp.since;
+    int sql_err = SQLITE_OK;
+
+    db_sync_clear(sa->db, artist_id);
+    db_rss_set_polled(sa->db, artist_id, time(NULL));
+    if (sa->cp.newest != last_update) {
+        sql_err = db_artist_update_time(sa->db, artist_id, sa->cp.newest);
+    }
+    if (sa->own_transaction && db_commit(sa->db) != SQLITE_OK) {
+        sql_err = sqlite3_errcode(sa->db);
+    }
+    if (sql_err != SQLITE_OK) {
+        vocagtk_warn_sql_db(sa->db);
+        return false;
+    }
+
+    if (sa->cp.newest != last_update) {
+        g_object_set(sa->artist, "update-at", (gint64) sa->cp.newest, NULL);
+        DEBUG("Updated artist %d update_at to %ld", artist_id, sa->cp.newest);
+    }
+    return true;
+}
+
+typedef struct {
+    VocagtkDownloader *dl;
+    sqlite3 *db;
+    GPtrArray *artists;
+    guint workers;
+    guint next; // index of the next artist to start
+    guint running;
+    guint finished;
+    guint failed;
+    VocagtkSyncProgressFunc progress;
+    gpointer progress_data;
+    guint commit_id; // idle source committing the open transaction
+    GHashTable *seen; // ids of the songs stored so far
+} SyncRun;
+
+typedef struct {
+    GTask *task; // of the run
+    VocagtkSyncArtist sa;
+    VocagtkResultIterator iter;
+} SyncWorker;
+
+static void sync_run_free(SyncRun *run) {
+    g_ptr_array_unref(run->artists);
+    g_hash_table_unref(run->seen);
+    g_free(run);
+}
+
+// All workers write through one transaction, which stays open while songs
+// keep arriving and is committed once the main loop has nothing else to do.
+static gboolean sync_run_commit_idle(gpointer user_data) {
+    SyncRun *run = user_data;
+    run->commit_id = 0;
+    db_commit(run->db);
+    return G_SOURCE_REMOVE;
+}
+
+static void sync_run_hold(SyncRun *run) {
+    if (run->commit_id) return;
+    db_begin(run->db);
+    run->commit_id = g_idle_add_full(
+        G_PRIORITY_DEFAULT_IDLE, sync_run_commit_idle, run, NULL
+    );
+}
+
+static void sync_run_flush(SyncRun *run) {
+    if (!run->commit_id) return;
+    g_source_remove(run->commit_id);
+    run->commit_id = 0;
+    db_commit(run->db);
+}
+
+static void sync_run_report(
+    SyncRun *run, SyncWorker *worker,
+    VocagtkSyncState state, GError const *error
+) {
+    if (!run->progress) return;
+    VocagtkSyncProgress progress = {
+        .artist = worker->sa.artist,
+        .state = state,
+        .songs = worker->sa.songs,
+        .error = error,
+        .finished = run->finished,
+        .failed = run->failed,
+        .total = run->artists->len,
+    };
+    run->progress(&progress, run->progress_data);
+}
+
+static void sync_worker_next(
+    GObject *source, GAsyncResult *res, gpointer user_data
+);
+
+// Start artists until workers of them are running, complete the run once
+// none is left.
+static void sync_run_pump(GTask *task) {
+    SyncRun *run = g_task_get_task_data(task);
+    GCancellable *cancellable = g_task_get_cancellable(task);
+
+    while (
+        run->running < run->workers && run->next < run->artists->len
+        && !g_cancellable_is_cancelled(cancellable)
+    ) {
+        SyncWorker *worker = g_new0(SyncWorker, 1);
+        worker->task = task;
+        VocagtkArtist *artist = g_ptr_array_index(run->artists, run->next++);
+        vocagtk_sync_artist_begin(
+            &worker->sa, run->db, artist, false, &worker->iter
+        );
+        worker->sa.seen = run->seen;
+        vocagtk_result_iterator_set_cancellable(&worker->iter, cancellable, 0);
+
+        run->running++;
+        sync_run_report(run, worker, VOCAGTK_SYNC_RUNNING, NULL);
+        vocagtk_result_iterator_next_async(
+            &worker->iter, run->dl, NULL, sync_worker_next, worker
+        );
+    }
+    if (run->running > 0) return;
+
+    sync_run_flush(run);
+    DEBUG(
+        "Updated %u artists, %u failed, %u songs stored",
+        run->finished - run->failed, run->failed,
+        g_hash_table_size(run->seen)
+    );
+    if (!g_task_return_error_if_cancelled(task)) {
+        g_task_return_int(task, run->failed);
+    }
+    g_object_unref(task);
+}
+
+static void sync_worker_next(
+    GObject *source, GAsyncResult *res, gpointer user_data
+) {
+    SyncWorker *worker = user_data;
+    GTask *task = worker->task;
+    SyncRun *run = g_task_get_task_data(task);
+
+    GError *error = NULL;
+    yyjson_val *song_json = vocagtk_result_iterator_next_finish(
+        &worker->iter, res, &error
+    );
+    if (song_json) {
+        sync_run_hold(run);
+        bool more = vocagtk_sync_artist_item(
+            &worker->sa, &worker->iter, song_json
+        );
+        sync_run_report(run, worker, VOCAGTK_SYNC_RUNNING, NULL);
+        if (more) {
+            vocagtk_result_iterator_next_async(
+                &worker->iter, run->dl, NULL, sync_worker_next, worker
+            );
+            return;
+        }
+        // Aborts the pages still downloading
+        vocagtk_result_iterator_clear(&worker->iter);
+    }
+
+    // The iterator is cleared once it is exhausted or failed
+    sync_run_hold(run);
+    bool ok = vocagtk_sync_artist_end(&worker->sa, error == NULL);
+    bool cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    if (error && !cancelled) {
+        vocagtk_warn_def(
+            "Failed to update artist %d: %s",
+            vocagtk_artist_get_id(worker->sa.artist), error->message
+        );
+    }
+
+    run->running--;
+    run->finished++;
+    if (!ok) run->failed++;
+    sync_run_report(
+        run, worker, ok ? VOCAGTK_SYNC_DONE : VOCAGTK_SYNC_FAILED, error
+    );
+
+    g_clear_error(&error);
+    g_free(worker);
+    sync_run_pump(task);
+}
+
+void vocagtk_sync_artists_async(
+    VocagtkDownloader *dl, sqlite3 *db,
+    GPtrArray *artists, guint workers,
+    VocagtkSyncProgressFunc progress, gpointer progress_data,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, vocagtk_sync_artists_async);
+
+    SyncRun *run = g_new0(SyncRun, 1);
+    run->dl = dl;
+    run->db = db;
+    run->artists = g_ptr_array_ref(artists);
+    run->workers = MAX(workers, 1);
+    run->progress = progress;
+    run->progress_data = progress_data;
+    run->seen = g_hash_table_new(NULL, NULL);
+    g_task_set_task_data(task, run, (GDestroyNotify) sync_run_free);
+
+    DEBUG(
+        "Updating %u artists, %u at once",
+        artists->len, run->workers
+    );
+    sync_run_pump(task);
+}
+
+gssize vocagtk_sync_artists_finish(GAsyncResult *res, GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, NULL), -1);
+    return g_task_propagate_int(G_TASK(res), error);
+}
+
+time_t vocagtk_sync_poll_interval(DbPollCadence const *cadence, time_t now) {
+    if (cadence->releases == 0) return VOCAGTK_POLL_MAX;
+
+    // Mean gap between the recent releases. An artist quiet for longer than
+    // that is slowing down, the time since its last release counts instead.
+    time_t gap = 0;
+    if (cadence->releases > 1) {
+        gap = (cadence->latest - cadence->oldest) / (cadence->releases - 1);
+    }
+    time_t quiet = now - cadence->latest;
+    time_t interval = MAX(gap, quiet) / VOCAGTK_POLL_PER_GAP;
+    return CLAMP(interval, VOCAGTK_POLL_MIN, VOCAGTK_POLL_MAX);
+}
+
+typedef struct {
+    int artist_id;
+    double overdue; // time since the last poll in intervals
+} SyncDue;
+
+static gint sync_due_cmp(gconstpointer a, gconstpointer b) {
+    double x = ((SyncDue const *) a)->overdue;
+    double y = ((SyncDue const *) b)->overdue;
+    return (x < y) - (x > y);
+}
+
+GArray *vocagtk_sync_due(sqlite3 *db, time_t now, guint max) {
+    GArray *cadences = g_array_new(false, false, sizeof(DbPollCadence));
+    db_rss_get_cadence(db, VOCAGTK_POLL_SAMPLES, cadences);
+
+    GArray *due = g_array_new(false, false, sizeof(SyncDue));
+    for (guint i = 0; i < cadences->len; i++) {
+        DbPollCadence const *cadence = &g_array_index(
+            cadences, DbPollCadence, i
+        );
+        time_t interval = vocagtk_sync_poll_interval(cadence, now);
+        time_t since = now - cadence->polled_at;
+        if (since < interval) continue;
+
+        SyncDue entry = {
+            .artist_id = cadence->artist_id,
+            .overdue = (double) since / interval,
+        };
+        g_array_append_val(due, entry);
+    }
+    g_array_sort(due, sync_due_cmp);
+
+    GArray *ids = g_array_new(false, false, sizeof(int));
+    for (guint i = 0; i < due->len && i < max; i++) {
+        g_array_append_val(ids, g_array_index(due, SyncDue, i).artist_id);
+    }
+    DEBUG(
+        "%u of %u artists are due for a poll, taking %u",
+        due->len, cadences->len, ids->len
+    );
+
+    g_array_free(due, true);
+    g_array_free(cadences, true);
+    return ids;
+}
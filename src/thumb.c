@@ -0,0 +1,386 @@
+#include <gdk/gdk.h>
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "exterr.h"
+#include "helper.h"
+#include "pack.h"
+#include "thumb.h"
+
+typedef struct {
+    VocagtkDownloader *dl; // doesn't take ownership
+    char *url;
+    char *key; // in the texture cache, url and size
+    int size; // of the thumbnail in px, 0 for the original
+    char *image_key; // of the original in the image cache
+    char *path; // of the original in the image cache
+    char *scaled_path; // of the thumbnail next to it
+    bool fetched; // downloaded by this load, not found is final then
+} ThumbLoad;
+
+typedef struct {
+    char *url; // the key, url and size
+    GdkTexture *texture;
+    gint64 bytes;
+    GList link; // in thumb_cache.lru
+} ThumbCached;
+
+// Textures are inserted by the workers and looked up on the main thread
+static struct {
+    GMutex lock;
+    GHashTable *entries; // key -> ThumbCached *
+    GQueue lru; // most recently used first
+    VocagtkThumbStats stats;
+} thumb_cache = {
+    .stats.max_bytes = VOCAGTK_THUMB_CACHE_MAX_BYTES,
+};
+
+// Thumbnails are stored there instead of a file each once it is open
+static VocagtkPack thumb_pack;
+
+static void thumb_cached_free(ThumbCached *cached) {
+    g_object_unref(cached->texture);
+    g_free(cached->url);
+    g_free(cached);
+}
+
+// Called with the lock held
+static void thumb_cache_evict(void) {
+    while (thumb_cache.stats.bytes > thumb_cache.stats.max_bytes) {
+        GList *link = g_queue_pop_tail_link(&thumb_cache.lru);
+        if (!link) break;
+        ThumbCached *cached = link->data;
+        thumb_cache.stats.bytes -= cached->bytes;
+        thumb_cache.stats.evictions++;
+        g_hash_table_remove(thumb_cache.entries, cached->url);
+    }
+}
+
+static void thumb_cache_insert(char const *url, GdkTexture *texture) {
+    g_mutex_lock(&thumb_cache.lock);
+    if (!thumb_cache.entries) {
+        thumb_cache.entries = g_hash_table_new_full(
+            g_str_hash, g_str_equal,
+            NULL, (GDestroyNotify) thumb_cached_free
+        );
+    }
+
+    // Another row may have loaded the same image meanwhile
+    ThumbCached *old = g_hash_table_lookup(thumb_cache.entries, url);
+    if (old) {
+        g_queue_unlink(&thumb_cache.lru, &old->link);
+        thumb_cache.stats.bytes -= old->bytes;
+        g_hash_table_remove(thumb_cache.entries, url);
+    }
+
+    ThumbCached *cached = g_new0(ThumbCached, 1);
+    cached->url = g_strdup(url);
+    cached->texture = g_object_ref(texture);
+    // What the pixels take once uploaded, 4 bytes each
+    cached->bytes = (gint64) gdk_texture_get_width(texture)
+        * gdk_texture_get_height(texture) * 4;
+    cached->link.data = cached;
+    g_hash_table_insert(thumb_cache.entries, cached->url, cached);
+    g_queue_push_head_link(&thumb_cache.lru, &cached->link);
+    thumb_cache.stats.bytes += cached->bytes;
+
+    thumb_cache_evict();
+    g_mutex_unlock(&thumb_cache.lock);
+}
+
+// Only lookups from outside count as hits or misses
+static GdkTexture *thumb_cache_get(char const *url, bool count) {
+    GdkTexture *texture = NULL;
+    g_mutex_lock(&thumb_cache.lock);
+    ThumbCached *cached = thumb_cache.entries
+        ? g_hash_table_lookup(thumb_cache.entries, url) : NULL;
+    if (cached) {
+        g_queue_unlink(&thumb_cache.lru, &cached->link);
+        g_queue_push_head_link(&thumb_cache.lru, &cached->link);
+        texture = g_object_ref(cached->texture);
+        if (count) thumb_cache.stats.hits++;
+    } else if (count) {
+        thumb_cache.stats.misses++;
+    }
+    g_mutex_unlock(&thumb_cache.lock);
+    return texture;
+}
+
+// Textures of every size of an image are cached on their own
+static char *thumb_key(char const *url, int size) {
+    if (size <= 0) return g_strdup(url);
+    return g_strdup_printf("%s@%d", url, size);
+}
+
+GdkTexture *vocagtk_thumb_lookup(char const *url, int size) {
+    char *key = thumb_key(url, size);
+    GdkTexture *texture = thumb_cache_get(key, true);
+    g_free(key);
+    return texture;
+}
+
+void vocagtk_thumb_cache_set_max_bytes(gint64 max_bytes) {
+    g_mutex_lock(&thumb_cache.lock);
+    thumb_cache.stats.max_bytes = max_bytes;
+    thumb_cache_evict();
+    g_mutex_unlock(&thumb_cache.lock);
+}
+
+void vocagtk_thumb_cache_get_stats(VocagtkThumbStats *stats) {
+    g_mutex_lock(&thumb_cache.lock);
+    *stats = thumb_cache.stats;
+    g_mutex_unlock(&thumb_cache.lock);
+}
+
+void vocagtk_thumb_cache_clear(void) {
+    g_mutex_lock(&thumb_cache.lock);
+    DEBUG(
+        "Texture cache: %u hits, %u misses, %u evictions, %ld of %ld bytes",
+        thumb_cache.stats.hits, thumb_cache.stats.misses,
+        thumb_cache.stats.evictions,
+        (long) thumb_cache.stats.bytes, (long) thumb_cache.stats.max_bytes
+    );
+    g_queue_init(&thumb_cache.lru);
+    g_clear_pointer(&thumb_cache.entries, g_hash_table_unref);
+    thumb_cache.stats.bytes = 0;
+    g_mutex_unlock(&thumb_cache.lock);
+}
+
+static void thumb_load_free(ThumbLoad *load) {
+    g_free(load->url);
+    g_free(load->key);
+    g_free(load->image_key);
+    g_free(load->path);
+    g_free(load->scaled_path);
+    g_free(load);
+}
+
+static void thumb_decode(gpointer data, gpointer user_data);
+
+static GThreadPool *thumb_pool(void) {
+    static gsize once = 0;
+    static GThreadPool *pool = NULL;
+    if (g_once_init_enter(&once)) {
+        pool = g_thread_pool_new(
+            thumb_decode, NULL, VOCAGTK_THUMB_WORKERS, false, NULL
+        );
+        g_once_init_leave(&once, 1);
+    }
+    return pool;
+}
+
+static void thumb_fetched(
+    GObject *source, GAsyncResult *res, gpointer user_data
+) {
+    GTask *task = user_data;
+
+    GError *error = NULL;
+    if (!vocagtk_downloader_image_finish(res, &error)) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+    g_thread_pool_push(thumb_pool(), task, NULL);
+}
+
+// Runs on the main context, the downloader lives there
+static gboolean thumb_fetch(gpointer user_data) {
+    GTask *task = user_data;
+    ThumbLoad *load = g_task_get_task_data(task);
+
+    // The index may still list a file removed behind its back
+    load->fetched = true;
+    vocagtk_image_cache_forget(&load->dl->image_cache, load->url);
+    vocagtk_downloader_image_async(
+        load->dl, load->url,
+        g_task_get_cancellable(task), 0,
+        thumb_fetched, task
+    );
+    return G_SOURCE_REMOVE;
+}
+
+static GdkTexture *thumb_texture_for_pixbuf(GdkPixbuf *pixbuf) {
+    GBytes *pixels = gdk_pixbuf_read_pixel_bytes(pixbuf);
+    GdkTexture *texture = gdk_memory_texture_new(
+        gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
+        gdk_pixbuf_get_has_alpha(pixbuf)
+            ? GDK_MEMORY_R8G8B8A8 : GDK_MEMORY_R8G8B8,
+        pixels, gdk_pixbuf_get_rowstride(pixbuf)
+    );
+    g_bytes_unref(pixels);
+    return texture;
+}
+
+typedef struct {
+    VocagtkDownloader *dl;
+    char *url;
+    gint64 bytes;
+} ThumbStored;
+
+static void thumb_stored_free(ThumbStored *stored) {
+    g_free(stored->url);
+    g_free(stored);
+}
+
+// Runs on the main context, which owns the image cache index
+static gboolean thumb_stored(gpointer user_data) {
+    ThumbStored *stored = user_data;
+    vocagtk_image_cache_grow(
+        &stored->dl->image_cache, stored->url, stored->bytes
+    );
+    return G_SOURCE_REMOVE;
+}
+
+// Decode the original scaled down to the thumbnail size and keep the
+// result in the pack or next to it, later loads only decode the small
+// copy. A file is written to a temporary one first so a half written one
+// is never taken.
+static GdkTexture *thumb_scale(ThumbLoad *load, GError **error) {
+    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(
+        load->path, load->size, load->size, true, error
+    );
+    if (!pixbuf) return NULL;
+
+    GError *save_error = NULL;
+    char *png = NULL;
+    gsize len = 0;
+    // Low compression, the point of the copy is a cheap decode
+    bool saved = gdk_pixbuf_save_to_buffer(
+        pixbuf, &png, &len, "png", &save_error, "compression", "1", NULL
+    ) && (
+        vocagtk_pack_store(&thumb_pack, load->image_key, load->size, png, len)
+        || g_file_set_contents_full(
+            load->scaled_path, png, len,
+            G_FILE_SET_CONTENTS_CONSISTENT, 0644, &save_error
+        )
+    );
+    g_free(png);
+    if (saved) {
+        // Counted against the quota of the original it is evicted with
+        ThumbStored *stored = g_new0(ThumbStored, 1);
+        stored->dl = load->dl;
+        stored->url = g_strdup(load->url);
+        stored->bytes = len;
+        g_main_context_invoke_full(
+            NULL, G_PRIORITY_DEFAULT, thumb_stored, stored,
+            (GDestroyNotify) thumb_stored_free
+        );
+    } else {
+        vocagtk_warn_def(
+            "Failed to store thumbnail %s: %s",
+            load->scaled_path, save_error->message
+        );
+        g_error_free(save_error);
+    }
+
+    GdkTexture *texture = thumb_texture_for_pixbuf(pixbuf);
+    g_object_unref(pixbuf);
+    return texture;
+}
+
+static bool thumb_not_found(GError const *error) {
+    return g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)
+        || g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+}
+
+// Runs on a worker thread, takes the reference to task
+static void thumb_decode(gpointer data, gpointer user_data) {
+    GTask *task = data;
+    ThumbLoad *load = g_task_get_task_data(task);
+
+    // Rows scrolled past while queued don't cost a decode
+    if (g_task_return_error_if_cancelled(task)) {
+        g_object_unref(task);
+        return;
+    }
+
+    GError *error = NULL;
+    GdkTexture *texture = NULL;
+    if (load->size <= 0) {
+        texture = gdk_texture_new_from_filename(load->path, &error);
+    } else {
+        GBytes *packed = vocagtk_pack_lookup(
+            &thumb_pack, load->image_key, load->size
+        );
+        if (packed) {
+            // Decoded straight from the mapping, nothing is opened
+            texture = gdk_texture_new_from_bytes(packed, NULL);
+            g_bytes_unref(packed);
+        } else {
+            texture = gdk_texture_new_from_filename(load->scaled_path, NULL);
+        }
+        if (!texture) texture = thumb_scale(load, &error);
+    }
+
+    if (texture) {
+        thumb_cache_insert(load->key, texture);
+        g_task_return_pointer(task, texture, g_object_unref);
+    } else if (!load->fetched && thumb_not_found(error)) {
+        // Not cached yet, decoded again once it is downloaded
+        g_error_free(error);
+        g_main_context_invoke(NULL, thumb_fetch, task);
+        return;
+    } else {
+        g_task_return_error(task, error);
+    }
+    g_object_unref(task);
+}
+
+void vocagtk_thumb_load_async(
+    VocagtkDownloader *dl, char const *url, int size,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data
+) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, vocagtk_thumb_load_async);
+
+    // Loaded by another row since the caller looked
+    char *key = thumb_key(url, size);
+    GdkTexture *texture = thumb_cache_get(key, false);
+    if (texture) {
+        g_free(key);
+        g_task_return_pointer(task, texture, g_object_unref);
+        g_object_unref(task);
+        return;
+    }
+
+    char *path = vocagtk_image_cache_path(&dl->image_cache, url);
+    vocagtk_image_cache_touch(&dl->image_cache, url);
+
+    ThumbLoad *load = g_new0(ThumbLoad, 1);
+    load->dl = dl;
+    load->url = g_strdup(url);
+    load->key = key;
+    load->image_key = vocagtk_image_cache_key(url);
+    load->size = size;
+    load->path = path;
+    if (size > 0) {
+        load->scaled_path = g_strdup_printf("%s.%d.png", path, size);
+    }
+    g_task_set_task_data(task, load, (GDestroyNotify) thumb_load_free);
+
+    g_thread_pool_push(thumb_pool(), task, NULL);
+}
+
+GdkTexture *vocagtk_thumb_load_finish(GAsyncResult *res, GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, NULL), NULL);
+    return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+// Runs on the worker thread removing the evicted images
+static void thumb_pack_evicted(char const *key, gpointer user_data) {
+    vocagtk_pack_remove(&thumb_pack, key);
+}
+
+bool vocagtk_thumb_pack_open(VocagtkDownloader *dl) {
+    if (!vocagtk_pack_open(&thumb_pack, dl->image_cache.dir, "thumbs")) {
+        return false;
+    }
+    dl->image_cache.evict_func = thumb_pack_evicted;
+    return true;
+}
+
+void vocagtk_thumb_pack_close(VocagtkDownloader *dl) {
+    dl->image_cache.evict_func = NULL;
+    vocagtk_pack_close(&thumb_pack);
+}
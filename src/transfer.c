@@ -0,0 +1,929 @@
+#include <curl/curl.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "exterr.h"
+#include "helper.h"
+#include "transfer.h"
+
+// Keep a handful of easy handles around, each one holds its own
+// connection cache which is lost on curl_easy_cleanup.
+#define VOCAGTK_IDLE_HANDLE_MAX (0x10)
+
+typedef struct {
+    GSource source;
+    CURLM *multi;
+    GHashTable *sockets; // curl_socket_t -> tag of g_source_add_unix_fd
+} CurlSource;
+
+typedef struct {
+    curl_socket_t fd;
+    int action;
+} SocketEvent;
+
+static void share_lock(
+    CURL *handle, curl_lock_data data,
+    curl_lock_access access, void *userp
+) {
+    VocagtkDownloader *dl = userp;
+    g_mutex_lock(&dl->share_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userp) {
+    VocagtkDownloader *dl = userp;
+    g_mutex_unlock(&dl->share_locks[data]);
+}
+
+static bool share_init(VocagtkDownloader *dl) {
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        g_mutex_init(&dl->share_locks[i]);
+    }
+
+    dl->share = curl_share_init();
+    if (!dl->share) return false;
+
+    curl_share_setopt(dl->share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(dl->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(dl->share, CURLSHOPT_USERDATA, dl);
+    curl_share_setopt(dl->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(dl->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(dl->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    return true;
+}
+
+static void share_clear(VocagtkDownloader *dl) {
+    curl_share_cleanup(dl->share);
+    dl->share = NULL;
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        g_mutex_clear(&dl->share_locks[i]);
+    }
+}
+
+// Options every handle gets, curl_easy_reset drops them in give_handle.
+// The reset keeps the share, so nothing cached is lost.
+static void setup_handle(VocagtkDownloader *dl, CURL *handle) {
+    curl_easy_setopt(handle, CURLOPT_SHARE, dl->share);
+    // VocaDB and its image host both speak h2, one connection per host
+    // carries all concurrent requests.
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(
+        handle, CURLOPT_CONNECTTIMEOUT, (long) VOCAGTK_TRANSFER_CONNECT_TIMEOUT
+    );
+    // Offer every encoding curl was built with, bodies are decoded on the
+    // fly before they reach the write callback. The JSON of VocaDB repeats
+    // the same keys all over and shrinks several times.
+    curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+}
+
+// Lets curl notice a cancellation while it is blocked in a transfer
+static int transfer_xferinfo_cb(
+    void *userp,
+    curl_off_t dltotal, curl_off_t dlnow,
+    curl_off_t ultotal, curl_off_t ulnow
+) {
+    VocagtkTransfer *xfer = userp;
+    return g_cancellable_is_cancelled(xfer->cancellable);
+}
+
+// Record whether the finished transfer reused a connection and how much
+// content encoding saved
+static void transfer_account(VocagtkTransfer *xfer) {
+    VocagtkDownloaderStats *stats = &xfer->dl->stats;
+    long connects = 0;
+    curl_easy_getinfo(xfer->handle, CURLINFO_NUM_CONNECTS, &connects);
+
+    // Counted by curl before decoding
+    curl_off_t wire = 0;
+    curl_easy_getinfo(xfer->handle, CURLINFO_SIZE_DOWNLOAD_T, &wire);
+    xfer->wire_bytes += wire;
+    g_atomic_pointer_add(&stats->wire_bytes, (gssize) wire);
+
+    g_atomic_int_inc(&stats->transfers);
+    if (connects > 0) {
+        g_atomic_int_add(&stats->conn_new, (gint) connects);
+    } else {
+        g_atomic_int_inc(&stats->conn_reused);
+    }
+}
+
+static CURL *take_handle(VocagtkDownloader *dl) {
+    CURL *handle = NULL;
+    g_mutex_lock(&dl->lock);
+    if (dl->idle->len > 0) {
+        handle = g_ptr_array_steal_index_fast(dl->idle, dl->idle->len - 1);
+    }
+    g_mutex_unlock(&dl->lock);
+
+    if (!handle) handle = curl_easy_init();
+    return handle;
+}
+
+static void give_handle(VocagtkDownloader *dl, CURL *handle) {
+    curl_easy_reset(handle);
+
+    g_mutex_lock(&dl->lock);
+    if (dl->idle->len < VOCAGTK_IDLE_HANDLE_MAX) {
+        g_ptr_array_add(dl->idle, handle);
+        handle = NULL;
+    }
+    g_mutex_unlock(&dl->lock);
+
+    if (handle) curl_easy_cleanup(handle);
+}
+
+static size_t transfer_header_cb(
+    char *buf, size_t size, size_t n,
+    void *userp
+) {
+    VocagtkTransfer *xfer = userp;
+    size_t len = size * n;
+
+    if (len > 5 && g_ascii_strncasecmp(buf, "HTTP/", 5) == 0) {
+        // A new response begins, e.g. after a redirect
+        g_clear_pointer(&xfer->etag, g_free);
+        g_clear_pointer(&xfer->last_modified, g_free);
+        xfer->no_store = false;
+        xfer->retry_after = 0;
+        return len;
+    }
+
+    char *line = g_strndup(buf, len);
+    char *value = strchr(line, ':');
+    if (value) {
+        *value++ = '\0';
+        g_strstrip(value);
+        if (g_ascii_strcasecmp(line, "ETag") == 0) {
+            g_free(xfer->etag);
+            xfer->etag = g_strdup(value);
+        } else if (g_ascii_strcasecmp(line, "Last-Modified") == 0) {
+            g_free(xfer->last_modified);
+            xfer->last_modified = g_strdup(value);
+        } else if (g_ascii_strcasecmp(line, "Cache-Control") == 0) {
+            if (strstr(value, "no-store")) xfer->no_store = true;
+        } else if (g_ascii_strcasecmp(line, "Retry-After") == 0) {
+            // Either delay-seconds or an HTTP-date
+            char *end = NULL;
+            gint64 seconds = g_ascii_strtoll(value, &end, 10);
+            if (end == value) {
+                time_t at = curl_getdate(value, NULL);
+                seconds = at < 0 ? 0 : at - time(NULL);
+            }
+            xfer->retry_after = CLAMP(seconds, 0, VOCAGTK_TRANSFER_DEADLINE);
+        }
+    }
+    g_free(line);
+    return len;
+}
+
+// Returns true if the transfer was answered from the HTTP cache.
+// A stale entry turns the request into a conditional one instead.
+static bool transfer_cache_begin(VocagtkTransfer *xfer) {
+    if (xfer->max_age <= 0) return false;
+
+    VocagtkHttpCacheEntry *entry = vocagtk_http_cache_lookup(
+        &xfer->dl->http_cache, xfer->url->str
+    );
+    if (!entry) return false;
+
+    if (entry->fresh) {
+        gsize len = 0;
+        guint8 const *data = g_bytes_get_data(entry->body, &len);
+        g_byte_array_append(xfer->body, data, len);
+        xfer->status = 200;
+        xfer->from_cache = true;
+        vocagtk_http_cache_entry_free(entry);
+        return true;
+    }
+
+    if (entry->etag) {
+        char *h = g_strdup_printf("If-None-Match: %s", entry->etag);
+        xfer->headers = curl_slist_append(xfer->headers, h);
+        g_free(h);
+    }
+    if (entry->last_modified) {
+        char *h = g_strdup_printf("If-Modified-Since: %s", entry->last_modified);
+        xfer->headers = curl_slist_append(xfer->headers, h);
+        g_free(h);
+    }
+    curl_easy_setopt(xfer->handle, CURLOPT_HTTPHEADER, xfer->headers);
+    xfer->stale = entry;
+    return false;
+}
+
+static void transfer_cache_end(VocagtkTransfer *xfer, CURLcode rcode) {
+    VocagtkHttpCache *cache = &xfer->dl->http_cache;
+    if (xfer->max_age <= 0 || rcode != CURLE_OK) return;
+
+    if (xfer->status == 304 && xfer->stale) {
+        gsize len = 0;
+        guint8 const *data = g_bytes_get_data(xfer->stale->body, &len);
+        g_byte_array_set_size(xfer->body, 0);
+        g_byte_array_append(xfer->body, data, len);
+        xfer->status = 200;
+        vocagtk_http_cache_refresh(cache, xfer->url->str, xfer->max_age);
+    } else if (xfer->status == 200 && !xfer->no_store) {
+        vocagtk_http_cache_store(
+            cache, xfer->url->str,
+            xfer->body->data, xfer->body->len,
+            xfer->etag, xfer->last_modified,
+            xfer->max_age
+        );
+    }
+}
+
+static size_t transfer_write_cb(
+    char *data, size_t size, size_t n,
+    void *userp
+) {
+    VocagtkTransfer *xfer = userp;
+    size_t len = size * n;
+    xfer->decoded_bytes += len;
+    g_atomic_pointer_add(&xfer->dl->stats.decoded_bytes, (gssize) len);
+
+    // Error pages are never data, dropping them keeps retries clean
+    long status = 0;
+    curl_easy_getinfo(xfer->handle, CURLINFO_RESPONSE_CODE, &status);
+    if (status >= 400) return len;
+
+    if (xfer->file) return fwrite(data, 1, len, xfer->file);
+    if (xfer->sink) {
+        xfer->sink(xfer, data, len, xfer->sink_data);
+        xfer->streamed += len;
+        // The cache still needs the whole body
+        if (xfer->max_age <= 0) return len;
+    }
+    g_byte_array_append(xfer->body, (guint8 const *) data, len);
+    return len;
+}
+
+// Bookkeeping shared by blocking and asynchronous transfers.
+// Returns rcode, turned into an error if the server answered with one.
+static CURLcode transfer_finish(VocagtkTransfer *xfer, CURLcode rcode) {
+    if (!xfer->from_cache) {
+        curl_easy_getinfo(
+            xfer->handle, CURLINFO_RESPONSE_CODE, &xfer->status
+        );
+        transfer_account(xfer);
+        transfer_cache_end(xfer, rcode);
+        if (rcode == CURLE_OK && xfer->status >= 400) {
+            rcode = CURLE_HTTP_RETURNED_ERROR;
+        }
+    }
+
+    // Served from the cache or revalidated, the sink has not seen it yet
+    if (
+        rcode == CURLE_OK
+        && xfer->sink && !xfer->streamed && xfer->body->len
+    ) {
+        xfer->sink(
+            xfer, (char const *) xfer->body->data, xfer->body->len,
+            xfer->sink_data
+        );
+    }
+    return rcode;
+}
+
+// The clock only starts with the first attempt, time spent queued behind
+// other transfers doesn't count
+static gint64 transfer_deadline(VocagtkTransfer const *xfer) {
+    if (xfer->deadline) return xfer->deadline;
+    return g_get_monotonic_time()
+        + (gint64) VOCAGTK_TRANSFER_DEADLINE * G_USEC_PER_SEC;
+}
+
+// Set up the next attempt, false if the deadline has passed already
+static bool transfer_arm(VocagtkTransfer *xfer) {
+    xfer->deadline = transfer_deadline(xfer);
+    gint64 left = xfer->deadline - g_get_monotonic_time();
+    if (left <= 0) return false;
+
+    xfer->attempts++;
+    curl_easy_setopt(
+        xfer->handle, CURLOPT_TIMEOUT_MS, (long) MAX(1, left / 1000)
+    );
+    return true;
+}
+
+static bool transfer_transient(VocagtkTransfer *xfer, CURLcode rcode) {
+    switch (rcode) {
+    case CURLE_HTTP_RETURNED_ERROR:
+        return xfer->status == 429 || xfer->status >= 500;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Returns the µs to wait before the next attempt, or -1 if there is none
+static gint64 transfer_retry_delay(VocagtkTransfer *xfer, CURLcode rcode) {
+    if (rcode == CURLE_OK || xfer->from_cache) return -1;
+    if (g_cancellable_is_cancelled(xfer->cancellable)) return -1;
+    if (xfer->attempts >= VOCAGTK_TRANSFER_MAX_ATTEMPTS) return -1;
+    // A sink can't take back what it was given
+    if (xfer->streamed) return -1;
+    if (!transfer_transient(xfer, rcode)) return -1;
+
+    // Half of the exponential step, plus up to the other half at random
+    gint64 step = MIN(
+        VOCAGTK_TRANSFER_BACKOFF_MAX,
+        (gint64) VOCAGTK_TRANSFER_BACKOFF_BASE << (xfer->attempts - 1)
+    );
+    gint64 delay = step / 2 + (gint64) (g_random_double() * (step / 2));
+    delay = MAX(delay, xfer->retry_after * G_USEC_PER_SEC);
+
+    if (g_get_monotonic_time() + delay >= xfer->deadline) return -1;
+    return delay;
+}
+
+// Forget the failed attempt
+static void transfer_rewind(VocagtkTransfer *xfer) {
+    g_byte_array_set_size(xfer->body, 0);
+    if (xfer->file) {
+        fflush(xfer->file);
+        if (ftruncate(fileno(xfer->file), 0) != 0) {
+            vocagtk_warn_def("Failed to truncate download of %s", xfer->url->str);
+        }
+        rewind(xfer->file);
+    }
+    g_clear_pointer(&xfer->etag, g_free);
+    g_clear_pointer(&xfer->last_modified, g_free);
+    xfer->no_store = false;
+    xfer->status = 0;
+    xfer->retry_after = 0;
+}
+
+// Conclude an attempt. Returns true if the transfer is done with *rcode,
+// false if it was rewound to be tried again at xfer->not_before, which
+// only happens if it may retry.
+static bool transfer_settle(
+    VocagtkTransfer *xfer, CURLcode *rcode, bool may_retry
+) {
+    *rcode = transfer_finish(xfer, *rcode);
+
+    if (xfer->limited && !xfer->from_cache) {
+        VocagtkRateFeedback feedback = VOCAGTK_RATE_FAILED;
+        if (xfer->status == 429 || xfer->status == 503) {
+            feedback = VOCAGTK_RATE_THROTTLED;
+        } else if (*rcode == CURLE_OK) {
+            feedback = VOCAGTK_RATE_OK;
+        }
+        vocagtk_rate_limiter_release(
+            &xfer->dl->limiter, xfer->holds_slot, feedback, xfer->retry_after
+        );
+        xfer->holds_slot = false;
+    }
+
+    gint64 delay = may_retry ? transfer_retry_delay(xfer, *rcode) : -1;
+    if (delay < 0) return true;
+
+    DEBUG(
+        "%s: %s, attempt %u, retrying in %" G_GINT64_FORMAT " ms",
+        xfer->url->str, curl_easy_strerror(*rcode),
+        xfer->attempts, delay / 1000
+    );
+    g_atomic_int_inc(&xfer->dl->stats.retries);
+    transfer_rewind(xfer);
+    xfer->not_before = g_get_monotonic_time() + delay;
+    return false;
+}
+
+static void engine_admit(VocagtkDownloader *dl);
+static void transfer_queue(VocagtkTransfer *xfer);
+
+static gboolean transfer_retry_cb(gpointer user_data) {
+    VocagtkTransfer *xfer = user_data;
+    xfer->retry_id = 0;
+    transfer_queue(xfer);
+    return G_SOURCE_REMOVE;
+}
+
+static void transfer_complete(VocagtkTransfer *xfer, CURLcode rcode) {
+    VocagtkDownloader *dl = xfer->dl;
+
+    if (transfer_settle(xfer, &rcode, true)) {
+        if (rcode != CURLE_OK) {
+            vocagtk_warn_curl(
+                "%s: %s", xfer->url->str, curl_easy_strerror(rcode)
+            );
+        }
+        xfer->func(xfer, rcode, xfer->user_data);
+        vocagtk_transfer_free(xfer);
+    } else {
+        gint64 delay = xfer->not_before - g_get_monotonic_time();
+        xfer->retry_id = g_timeout_add(
+            (guint) MAX(0, (delay + 999) / 1000), transfer_retry_cb, xfer
+        );
+    }
+
+    // A slot of the window may have been freed
+    engine_admit(dl);
+}
+
+static gboolean transfer_complete_cached(gpointer user_data) {
+    transfer_complete(user_data, CURLE_OK);
+    return G_SOURCE_REMOVE;
+}
+
+// Take the transfer back from wherever it waits and fail it
+static gboolean transfer_abort_cb(gpointer user_data) {
+    VocagtkTransfer *xfer = user_data;
+    VocagtkDownloader *dl = xfer->dl;
+
+    if (xfer->running) {
+        curl_multi_remove_handle(dl->multi, xfer->handle);
+        xfer->running = false;
+    } else if (xfer->queued) {
+        g_queue_remove(&dl->waiting, xfer);
+        xfer->queued = false;
+    } else if (xfer->retry_id) {
+        g_source_remove(xfer->retry_id);
+        xfer->retry_id = 0;
+    } else {
+        // Answered from the cache, it is completing anyway
+        return G_SOURCE_REMOVE;
+    }
+
+    DEBUG("Cancelled %s", xfer->url->str);
+    transfer_complete(xfer, CURLE_ABORTED_BY_CALLBACK);
+    return G_SOURCE_REMOVE;
+}
+
+// May be called from any thread, and from g_cancellable_connect itself.
+// Only the first call schedules the abort. The main thread reads
+// abort_source once g_cancellable_disconnect returned, which waits for this
+// handler to finish.
+static void transfer_cancelled_cb(GCancellable *cancellable, gpointer user_data) {
+    VocagtkTransfer *xfer = user_data;
+    if (!g_atomic_int_compare_and_exchange(&xfer->aborting, 0, 1)) return;
+
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, transfer_abort_cb, xfer, NULL);
+    xfer->abort_source = source;
+    g_source_attach(source, g_main_context_default());
+}
+
+// Hand the transfer over to curl
+static void transfer_add(VocagtkTransfer *xfer) {
+    if (!transfer_arm(xfer)) {
+        transfer_complete(xfer, CURLE_OPERATION_TIMEDOUT);
+        return;
+    }
+
+    CURLMcode mcode = curl_multi_add_handle(xfer->dl->multi, xfer->handle);
+    if (mcode != CURLM_OK) {
+        vocagtk_warn_curl("%s", curl_multi_strerror(mcode));
+        transfer_complete(xfer, CURLE_FAILED_INIT);
+        return;
+    }
+    xfer->running = true;
+}
+
+static gboolean engine_admit_cb(gpointer user_data) {
+    VocagtkDownloader *dl = user_data;
+    dl->admit_id = 0;
+    engine_admit(dl);
+    return G_SOURCE_REMOVE;
+}
+
+// Start waiting transfers as far as the rate limiter lets us
+static void engine_admit(VocagtkDownloader *dl) {
+    while (!g_queue_is_empty(&dl->waiting)) {
+        gint64 wait = vocagtk_rate_limiter_acquire(&dl->limiter, true);
+        if (wait < 0) return; // a completion calls us again
+        if (wait > 0) {
+            if (!dl->admit_id) {
+                dl->admit_id = g_timeout_add(
+                    (guint) ((wait + 999) / 1000), engine_admit_cb, dl
+                );
+            }
+            return;
+        }
+
+        VocagtkTransfer *xfer = g_queue_pop_head(&dl->waiting);
+        xfer->queued = false;
+        xfer->holds_slot = true;
+        transfer_add(xfer);
+    }
+}
+
+static void transfer_queue(VocagtkTransfer *xfer) {
+    if (!xfer->limited) {
+        transfer_add(xfer);
+        return;
+    }
+    g_queue_push_tail(&xfer->dl->waiting, xfer);
+    xfer->queued = true;
+    engine_admit(xfer->dl);
+}
+
+static void curl_source_drain(CurlSource *self) {
+    CURLMsg *msg = NULL;
+    int left = 0;
+    while ((msg = curl_multi_info_read(self->multi, &left))) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        // msg is invalidated by curl_multi_remove_handle
+        CURL *handle = msg->easy_handle;
+        CURLcode rcode = msg->data.result;
+
+        VocagtkTransfer *xfer = NULL;
+        curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **) &xfer);
+        curl_multi_remove_handle(self->multi, handle);
+        xfer->running = false;
+        transfer_complete(xfer, rcode);
+    }
+}
+
+static gboolean curl_source_dispatch(
+    GSource *source,
+    GSourceFunc callback, gpointer user_data
+) {
+    CurlSource *self = (CurlSource *) source;
+    int running = 0;
+
+    // socket_action may add or remove sockets, so collect the events first
+    GArray *events = g_array_new(FALSE, FALSE, sizeof(SocketEvent));
+    GHashTableIter iter;
+    gpointer key = NULL, tag = NULL;
+    g_hash_table_iter_init(&iter, self->sockets);
+    while (g_hash_table_iter_next(&iter, &key, &tag)) {
+        GIOCondition cond = g_source_query_unix_fd(source, tag);
+        if (!cond) continue;
+
+        SocketEvent ev = { .fd = GPOINTER_TO_INT(key), .action = 0 };
+        if (cond & G_IO_IN) ev.action |= CURL_CSELECT_IN;
+        if (cond & G_IO_OUT) ev.action |= CURL_CSELECT_OUT;
+        if (cond & (G_IO_ERR | G_IO_HUP)) ev.action |= CURL_CSELECT_ERR;
+        g_array_append_val(events, ev);
+    }
+
+    for (guint i = 0; i < events->len; i++) {
+        SocketEvent *ev = &g_array_index(events, SocketEvent, i);
+        curl_multi_socket_action(self->multi, ev->fd, ev->action, &running);
+    }
+    g_array_free(events, TRUE);
+
+    gint64 ready_time = g_source_get_ready_time(source);
+    if (ready_time >= 0 && ready_time <= g_source_get_time(source)) {
+        g_source_set_ready_time(source, -1);
+        curl_multi_socket_action(
+            self->multi, CURL_SOCKET_TIMEOUT, 0, &running
+        );
+    }
+
+    curl_source_drain(self);
+    return G_SOURCE_CONTINUE;
+}
+
+static void curl_source_finalize(GSource *source) {
+    CurlSource *self = (CurlSource *) source;
+    g_hash_table_unref(self->sockets);
+}
+
+static GSourceFuncs curl_source_funcs = {
+    .prepare = NULL,
+    .check = NULL,
+    .dispatch = curl_source_dispatch,
+    .finalize = curl_source_finalize,
+};
+
+static int curl_source_socket_cb(
+    CURL *handle, curl_socket_t fd, int what,
+    void *userp, void *tag
+) {
+    CurlSource *self = userp;
+    GSource *source = userp;
+
+    if (what == CURL_POLL_REMOVE) {
+        if (tag) g_source_remove_unix_fd(source, tag);
+        g_hash_table_remove(self->sockets, GINT_TO_POINTER(fd));
+        curl_multi_assign(self->multi, fd, NULL);
+        return 0;
+    }
+
+    GIOCondition cond = G_IO_ERR | G_IO_HUP;
+    if (what & CURL_POLL_IN) cond |= G_IO_IN;
+    if (what & CURL_POLL_OUT) cond |= G_IO_OUT;
+
+    if (tag) {
+        g_source_modify_unix_fd(source, tag, cond);
+    } else {
+        tag = g_source_add_unix_fd(source, fd, cond);
+        g_hash_table_insert(self->sockets, GINT_TO_POINTER(fd), tag);
+        curl_multi_assign(self->multi, fd, tag);
+    }
+    return 0;
+}
+
+static int curl_source_timer_cb(
+    CURLM *multi, long timeout_ms, void *userp
+) {
+    GSource *source = userp;
+
+    // Never call socket_action from here, just wake up the source
+    if (timeout_ms < 0) {
+        g_source_set_ready_time(source, -1);
+    } else {
+        g_source_set_ready_time(
+            source, g_get_monotonic_time() + (gint64) timeout_ms * 1000
+        );
+    }
+    return 0;
+}
+
+// Written to cache_path once the files of the flat layout are gone
+#define ENGINE_FLAT_IMAGES_MARKER "images.migrated"
+
+// Runs on a worker thread. Images used to be stored right in cache_path
+// under the last segment of their URL, their thumbnails next to them as
+// <name>.<size>.png. Nothing reads them since the image cache moved to
+// cache_path/images, only names of that form are removed.
+static void engine_drop_flat_images(
+    GTask *task, gpointer source, gpointer task_data,
+    GCancellable *cancellable
+) {
+    char const *cache_path = task_data;
+    GRegex *flat = g_regex_new(
+        "^[^/]+\\.(jpe?g|png|gif|webp)(\\?[^/]*)?(\\.[0-9]+\\.png)?$",
+        G_REGEX_CASELESS, 0, NULL
+    );
+    GDir *dir = g_dir_open(cache_path, 0, NULL);
+    guint removed = 0;
+    char const *name;
+    while (dir && (name = g_dir_read_name(dir))) {
+        if (!g_regex_match(flat, name, 0, NULL)) continue;
+        char *path = g_build_filename(cache_path, name, NULL);
+        if (g_file_test(path, G_FILE_TEST_IS_REGULAR) && g_remove(path) == 0) {
+            removed++;
+        }
+        g_free(path);
+    }
+    if (dir) g_dir_close(dir);
+    g_regex_unref(flat);
+    if (removed) DEBUG("Removed %u files of the old image cache", removed);
+
+    char *marker = g_build_filename(cache_path, ENGINE_FLAT_IMAGES_MARKER, NULL);
+    if (!g_file_set_contents(marker, "", 0, NULL)) {
+        DEBUG("Failed to write %s", marker);
+    }
+    g_free(marker);
+    g_task_return_boolean(task, true);
+}
+
+// Size cap of the HTTP cache, overridden by the environment variable of
+// the same name in bytes
+static gint64 engine_http_cache_max_bytes(void) {
+    char const *env = g_getenv("VOCAGTK_HTTP_CACHE_MAX_BYTES");
+    if (!env || !*env) return VOCAGTK_HTTP_CACHE_MAX_BYTES;
+
+    gint64 max_bytes = 0;
+    GError *error = NULL;
+    if (!g_ascii_string_to_signed(env, 10, 0, G_MAXINT64, &max_bytes, &error)) {
+        vocagtk_warn_def(
+            "Ignored VOCAGTK_HTTP_CACHE_MAX_BYTES: %s", error->message
+        );
+        g_error_free(error);
+        return VOCAGTK_HTTP_CACHE_MAX_BYTES;
+    }
+    DEBUG("HTTP cache capped at %" G_GINT64_FORMAT " bytes", max_bytes);
+    return max_bytes;
+}
+
+bool vocagtk_engine_init(VocagtkDownloader *dl) {
+    char *http_cache_path = g_build_filename(dl->cache_path, "http.db", NULL);
+    g_mkdir_with_parents(dl->cache_path, 0755);
+    vocagtk_http_cache_open(
+        &dl->http_cache, http_cache_path, engine_http_cache_max_bytes()
+    );
+    g_free(http_cache_path);
+    char *image_cache_dir = g_build_filename(dl->cache_path, "images", NULL);
+    vocagtk_image_cache_open(
+        &dl->image_cache, image_cache_dir, VOCAGTK_IMAGE_CACHE_MAX_BYTES
+    );
+    g_free(image_cache_dir);
+
+    // Left over by older versions, removed once
+    char *marker = g_build_filename(
+        dl->cache_path, ENGINE_FLAT_IMAGES_MARKER, NULL
+    );
+    if (!g_file_test(marker, G_FILE_TEST_EXISTS)) {
+        GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+        g_task_set_task_data(task, g_strdup(dl->cache_path), g_free);
+        g_task_run_in_thread(task, engine_drop_flat_images);
+        g_object_unref(task);
+    }
+    g_free(marker);
+
+    g_mutex_init(&dl->lock);
+    dl->idle = g_ptr_array_new();
+    vocagtk_rate_limiter_init(&dl->limiter);
+    g_queue_init(&dl->waiting);
+
+    if (!share_init(dl)) return false;
+
+    dl->multi = curl_multi_init();
+    if (!dl->multi) return false;
+    curl_multi_setopt(dl->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    CurlSource *self = (CurlSource *) g_source_new(
+        &curl_source_funcs, sizeof(CurlSource)
+    );
+    self->multi = dl->multi;
+    self->sockets = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_source_set_name((GSource *) self, "vocagtk curl multi");
+
+    curl_multi_setopt(
+        dl->multi, CURLMOPT_SOCKETFUNCTION, curl_source_socket_cb
+    );
+    curl_multi_setopt(dl->multi, CURLMOPT_SOCKETDATA, self);
+    curl_multi_setopt(dl->multi, CURLMOPT_TIMERFUNCTION, curl_source_timer_cb);
+    curl_multi_setopt(dl->multi, CURLMOPT_TIMERDATA, self);
+
+    dl->source = (GSource *) self;
+    g_source_attach(dl->source, NULL);
+    return true;
+}
+
+void vocagtk_engine_clear(VocagtkDownloader *dl) {
+    if (dl->admit_id) {
+        g_source_remove(dl->admit_id);
+        dl->admit_id = 0;
+    }
+    // Never started, nobody is going to hear back from them
+    g_queue_clear_full(&dl->waiting, (GDestroyNotify) vocagtk_transfer_free);
+
+    if (dl->multi) {
+        // The source is going away, don't let curl call back into it
+        curl_multi_setopt(dl->multi, CURLMOPT_SOCKETFUNCTION, NULL);
+        curl_multi_setopt(dl->multi, CURLMOPT_TIMERFUNCTION, NULL);
+        curl_multi_cleanup(dl->multi);
+        dl->multi = NULL;
+    }
+    if (dl->source) {
+        g_source_destroy(dl->source);
+        g_source_unref(dl->source);
+        dl->source = NULL;
+    }
+    if (dl->idle) {
+        for (guint i = 0; i < dl->idle->len; i++) {
+            curl_easy_cleanup(g_ptr_array_index(dl->idle, i));
+        }
+        g_ptr_array_free(dl->idle, TRUE);
+        dl->idle = NULL;
+        g_mutex_clear(&dl->lock);
+    }
+    if (dl->share) {
+        DEBUG(
+            "%d transfers, %d new connections, %d reused, %d retries, "
+            "throttled %u times",
+            g_atomic_int_get(&dl->stats.transfers),
+            g_atomic_int_get(&dl->stats.conn_new),
+            g_atomic_int_get(&dl->stats.conn_reused),
+            g_atomic_int_get(&dl->stats.retries),
+            dl->limiter.throttled
+        );
+        DEBUG(
+            "%" G_GSIZE_FORMAT " bytes on the wire, "
+            "%" G_GSIZE_FORMAT " decoded",
+            (gsize) g_atomic_pointer_get(&dl->stats.wire_bytes),
+            (gsize) g_atomic_pointer_get(&dl->stats.decoded_bytes)
+        );
+        DEBUG(
+            "%d result pages requested, %d with fixed size pages",
+            g_atomic_int_get(&dl->stats.pages),
+            g_atomic_int_get(&dl->stats.pages_fixed)
+        );
+        share_clear(dl);
+    }
+    vocagtk_http_cache_close(&dl->http_cache);
+    vocagtk_image_cache_close(&dl->image_cache);
+}
+
+VocagtkTransfer *vocagtk_transfer_new(
+    VocagtkDownloader *dl,
+    char const *url
+) {
+    VocagtkTransfer *xfer = g_new0(VocagtkTransfer, 1);
+    xfer->dl = dl;
+    xfer->handle = take_handle(dl);
+    xfer->url = g_string_new(url);
+    xfer->body = g_byte_array_new();
+
+    setup_handle(dl, xfer->handle);
+
+    curl_easy_setopt(xfer->handle, CURLOPT_URL, xfer->url->str);
+    curl_easy_setopt(xfer->handle, CURLOPT_PRIVATE, xfer);
+    curl_easy_setopt(xfer->handle, CURLOPT_WRITEFUNCTION, transfer_write_cb);
+    curl_easy_setopt(xfer->handle, CURLOPT_WRITEDATA, xfer);
+    curl_easy_setopt(xfer->handle, CURLOPT_HEADERFUNCTION, transfer_header_cb);
+    curl_easy_setopt(xfer->handle, CURLOPT_HEADERDATA, xfer);
+    curl_easy_setopt(xfer->handle, CURLOPT_XFERINFOFUNCTION, transfer_xferinfo_cb);
+    curl_easy_setopt(xfer->handle, CURLOPT_XFERINFODATA, xfer);
+    curl_easy_setopt(xfer->handle, CURLOPT_NOPROGRESS, 0L);
+    return xfer;
+}
+
+void vocagtk_transfer_set_file(VocagtkTransfer *xfer, FILE *f) {
+    xfer->file = f;
+}
+
+void vocagtk_transfer_set_max_age(VocagtkTransfer *xfer, gint64 max_age) {
+    xfer->max_age = max_age;
+}
+
+void vocagtk_transfer_set_rate_limited(VocagtkTransfer *xfer) {
+    xfer->limited = true;
+}
+
+void vocagtk_transfer_set_sink(
+    VocagtkTransfer *xfer,
+    VocagtkTransferSink sink, gpointer user_data
+) {
+    xfer->sink = sink;
+    xfer->sink_data = user_data;
+}
+
+void vocagtk_transfer_set_cancellable(
+    VocagtkTransfer *xfer, GCancellable *cancellable
+) {
+    g_set_object(&xfer->cancellable, cancellable);
+}
+
+void vocagtk_transfer_set_deadline(VocagtkTransfer *xfer, gint64 deadline) {
+    if (deadline > 0) xfer->deadline = deadline;
+}
+
+void vocagtk_transfer_free(VocagtkTransfer *xfer) {
+    if (!xfer) return;
+    if (xfer->cancel_id) g_cancellable_disconnect(xfer->cancellable, xfer->cancel_id);
+    if (xfer->abort_source) {
+        g_source_destroy(xfer->abort_source);
+        g_source_unref(xfer->abort_source);
+    }
+    g_clear_object(&xfer->cancellable);
+    give_handle(xfer->dl, xfer->handle);
+    g_string_free(xfer->url, TRUE);
+    g_byte_array_free(xfer->body, TRUE);
+    curl_slist_free_all(xfer->headers);
+    vocagtk_http_cache_entry_free(xfer->stale);
+    g_free(xfer->etag);
+    g_free(xfer->last_modified);
+    g_free(xfer);
+}
+
+// Take a token for a blocking attempt, which can't wait for one.
+// The window only bounds the multi handle, a blocking one runs anyway.
+static bool transfer_acquire_now(VocagtkTransfer *xfer) {
+    if (!xfer->limited) return true;
+    return vocagtk_rate_limiter_acquire(&xfer->dl->limiter, false) == 0;
+}
+
+CURLcode vocagtk_transfer_perform(VocagtkTransfer *xfer) {
+    if (transfer_cache_begin(xfer)) {
+        transfer_finish(xfer, CURLE_OK);
+        return CURLE_OK;
+    }
+
+    CURLcode rcode = CURLE_OPERATION_TIMEDOUT;
+    if (g_cancellable_is_cancelled(xfer->cancellable)) {
+        rcode = CURLE_ABORTED_BY_CALLBACK;
+    } else if (transfer_acquire_now(xfer) && transfer_arm(xfer)) {
+        rcode = curl_easy_perform(xfer->handle);
+    }
+    transfer_settle(xfer, &rcode, false);
+    return rcode;
+}
+
+void vocagtk_transfer_start(
+    VocagtkTransfer *xfer,
+    VocagtkTransferFunc func, gpointer user_data
+) {
+    xfer->func = func;
+    xfer->user_data = user_data;
+
+    if (transfer_cache_begin(xfer)) {
+        g_idle_add(transfer_complete_cached, xfer);
+        return;
+    }
+
+    if (xfer->cancellable) {
+        xfer->cancel_id = g_cancellable_connect(
+            xfer->cancellable, G_CALLBACK(transfer_cancelled_cb), xfer, NULL
+        );
+    }
+    transfer_queue(xfer);
+}
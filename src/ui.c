@@ -5,6 +5,7 @@
 #include "entrybox.h"
 #include "exterr.h"
 #include "parse.h"
+#include "sync.h"
 #include "ui.h"
 
 typedef struct {
@@ -14,14 +15,54 @@ typedef struct {
 
 static void on_search_button_clicked(GtkButton *button, gpointer user_data) {
     (void) button;
-    call_search((AppState *) user_data);
+    AppState *ctx = (AppState *) user_data;
+    if (ctx->search_widgets.debounce_id) {
+        g_source_remove(ctx->search_widgets.debounce_id);
+        ctx->search_widgets.debounce_id = 0;
+    }
+    call_search(ctx);
+}
+
+static void search_cancel(AppState *ctx);
+static void search_start(AppState *ctx);
+
+static gboolean on_search_debounced(gpointer user_data) {
+    AppState *ctx = (AppState *) user_data;
+    ctx->search_widgets.debounce_id = 0;
+    search_start(ctx);
+    return G_SOURCE_REMOVE;
+}
+
+// Search as the user types. Nothing is queried, not even the local
+// database, until the query stayed the same for a moment.
+static void on_search_changed(GtkEditable *_, gpointer user_data) {
+    AppState *ctx = (AppState *) user_data;
+    if (ctx->search_widgets.debounce_id) {
+        g_source_remove(ctx->search_widgets.debounce_id);
+        ctx->search_widgets.debounce_id = 0;
+    }
+
+    char const *query_str =
+        gtk_editable_get_text(GTK_EDITABLE(ctx->search_widgets.field));
+    if (!query_str || !*query_str) {
+        search_cancel(ctx);
+        return;
+    }
+    ctx->search_widgets.debounce_id = g_timeout_add(
+        VOCAGTK_SEARCH_DEBOUNCE, on_search_debounced, ctx
+    );
+}
+
+static void on_search_type_changed(
+    GtkDropDown *_, GParamSpec *spec, gpointer user_data
+) {
+    on_search_changed(NULL, user_data);
 }
 
 static void on_refresh_rss_clicked(GtkButton *button, gpointer user_data) {
     (void) button;
     AppState *ctx = (AppState *) user_data;
     update_artists(ctx);
-    refresh_rss_song(ctx);
 }
 
 static void add_entry_factory_setup(
@@ -61,6 +102,19 @@ static void toggle_select_all(
     }
 }
 
+static int entry_get_id(VocagtkEntry const *entry) {
+    switch (entry->type_label) {
+    case VOCAGTK_ENTRY_TYPE_LABEL_ALBUM:
+        return entry->entry.album->id;
+    case VOCAGTK_ENTRY_TYPE_LABEL_ARTIST:
+        return entry->entry.artist->id;
+    case VOCAGTK_ENTRY_TYPE_LABEL_SONG:
+        return entry->entry.song->id;
+    default:
+        return -1;
+    }
+}
+
 /**
  * Watch all selected entries in the selection model
  * @param _ GtkButton that triggered the action (unused)
@@ -79,6 +133,11 @@ static void watch_entries(GtkButton *_, EntryListCtx *ctx) {
     GtkBitsetIter iter;
     bool next = true;
     guint idx = 0;
+    // The same entity may be selected more than once, e.g. an artist
+    // listed in several lists, watch it only once
+    GHashTable *seen = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, NULL
+    );
 
     for (
          next = gtk_bitset_iter_init_first(&iter, selection, &idx);
@@ -94,12 +153,22 @@ static void watch_entries(GtkButton *_, EntryListCtx *ctx) {
             continue;
         }
 
+        char *key = g_strdup_printf(
+            "%d:%d", entry->type_label, entry_get_id(entry)
+        );
+        if (!g_hash_table_add(seen, key)) {
+            DEBUG("Entry at index %u already watched, skipping", idx);
+            g_object_unref(entry);
+            continue;
+        }
+
         // Call watch_entry for each selected entry
         watch_entry(entry, ctx, idx);
 
         // Unref the entry after use (g_list_model_get_item returns a ref)
         g_object_unref(entry);
     }
+    g_hash_table_unref(seen);
 
     DEBUG("Completed batch watch operation");
 }
@@ -511,10 +580,25 @@ void build_rss_song_box(GtkBuilder *main, AppState *ctx) {
     );
     gtk_box_append(GTK_BOX(controls), refresh_button);
 
+    // Progress of the update started by refresh, hidden otherwise
+    GtkWidget *progress = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(progress), true);
+    gtk_widget_set_hexpand(progress, true);
+    gtk_widget_set_valign(progress, GTK_ALIGN_CENTER);
+    gtk_widget_set_visible(progress, false);
+    gtk_box_append(GTK_BOX(controls), progress);
+    ctx->rss_progress = GTK_PROGRESS_BAR(progress);
+
     gtk_box_append(GTK_BOX(box), GTK_WIDGET(root));
 
     refresh_rss_song(ctx);
 
+    // Keep the songs fresh without waiting for refresh
+    ctx->rss_poll.last_tick = g_get_monotonic_time();
+    ctx->rss_poll.source_id = g_timeout_add_seconds(
+        VOCAGTK_POLL_TICK, on_rss_poll, ctx
+    );
+
     g_object_unref(builder);
 }
 
@@ -558,6 +642,24 @@ void build_search(GtkBuilder *main, AppState *ctx) {
         G_CALLBACK(on_search_button_clicked), ctx
     );
 
+    g_signal_connect(
+        search_field, "changed", G_CALLBACK(on_search_changed), ctx
+    );
+    g_signal_connect(
+        type_selector, "notify::selected",
+        G_CALLBACK(on_search_type_changed), ctx
+    );
+
+    // Results are loaded in batches as the list is scrolled
+    GObject *scroll = gtk_builder_get_object(list_builder, "scroll");
+    GtkAdjustment *adj = gtk_scrolled_window_get_vadjustment(
+        GTK_SCROLLED_WINDOW(scroll)
+    );
+    g_signal_connect(
+        adj, "value-changed", G_CALLBACK(on_search_scrolled), ctx
+    );
+    g_signal_connect(adj, "changed", G_CALLBACK(on_search_scrolled), ctx);
+
     gtk_box_append(GTK_BOX(search_box), GTK_WIDGET(search_panel));
     gtk_box_append(GTK_BOX(search_box), GTK_WIDGET(entry_list));
 
@@ -686,58 +788,113 @@ void build_playlist(GtkBuilder *main, AppState *ctx) {
     g_object_unref(ctrl_builder);
 }
 
-void update_artist(AppState *ctx, VocagtkArtist *artist) {
-    int artist_id = vocagtk_artist_get_id(artist);
-    time_t last_update = vocagtk_artist_get_update_at(artist);
+static void on_sync_progress(
+    VocagtkSyncProgress const *progress, gpointer user_data
+) {
+    AppState *ctx = (AppState *) user_data;
+    char const *name = vocagtk_artist_get_name(progress->artist);
+
+    char *text;
+    if (progress->state == VOCAGTK_SYNC_FAILED) {
+        text = g_strdup_printf(
+            "%u/%u, failed to update %s: %s",
+            progress->finished, progress->total, name,
+            progress->error ? progress->error->message : "database error"
+        );
+    } else {
+        text = g_strdup_printf(
+            "%u/%u, %s: %zu new songs",
+            progress->finished, progress->total, name, progress->songs
+        );
+    }
+    gtk_progress_bar_set_text(ctx->rss_progress, text);
+    gtk_progress_bar_set_fraction(
+        ctx->rss_progress, (double) progress->finished / progress->total
+    );
+    g_free(text);
+}
 
-    DEBUG("Updating artist %d, last update at %ld", artist_id, last_update);
+static void sync_queued(AppState *ctx);
 
-    VocagtkResultIterator iter;
-    vocagtk_downloader_update(artist_id, last_update, &iter);
+static void on_sync_done(GObject *_, GAsyncResult *res, gpointer user_data) {
+    AppState *ctx = (AppState *) user_data;
+    g_clear_object(&ctx->rss_sync);
+
+    GError *error = NULL;
+    gssize failed = vocagtk_sync_artists_finish(res, &error);
+    if (failed < 0) {
+        gtk_progress_bar_set_text(ctx->rss_progress, error->message);
+        g_error_free(error);
+    } else if (failed > 0) {
+        char *text = g_strdup_printf("%zd artists failed to update", failed);
+        gtk_progress_bar_set_text(ctx->rss_progress, text);
+        g_free(text);
+    } else {
+        gtk_widget_set_visible(GTK_WIDGET(ctx->rss_progress), false);
+    }
 
-    CURLcode curl_err = CURLE_OK;
-    int sql_err = SQLITE_OK;
-    yyjson_val *song_json = NULL;
+    DEBUG("Finished batch update of all artists");
+    refresh_rss_song(ctx);
+    sync_queued(ctx);
+}
 
-    while (
-         (song_json = vocagtk_result_iterator_next(&iter, &ctx->dl, &curl_err))
-         != NULL
-    ) {
-        if (curl_err != CURLE_OK) {
-            vocagtk_warn_curl_rcode(curl_err);
-            continue;
-        }
+static void on_sync_loaded(
+    GObject *_, GAsyncResult *res,
+    gpointer user_data
+) {
+    AppState *ctx = (AppState *) user_data;
 
-        // 1. Insert song itself into database
-        sql_err = db_song_add_from_json(ctx->db, song_json);
-        if (sql_err != SQLITE_OK) {
-            vocagtk_warn_sql_db(ctx->db);
+    GError *error = NULL;
+    GPtrArray *artists = vocagtk_artist_new_many_finish(res, &error);
+    if (!artists || artists->len == 0) {
+        g_clear_object(&ctx->rss_sync);
+        if (error) {
+            gtk_progress_bar_set_text(ctx->rss_progress, error->message);
+            g_error_free(error);
+        } else {
+            gtk_widget_set_visible(GTK_WIDGET(ctx->rss_progress), false);
         }
+        if (artists) g_ptr_array_unref(artists);
+        sync_queued(ctx);
+        return;
+    }
 
-        // 2. Insert song-album relations into database
-        db_insert_song_albums(ctx->db, song_json, &sql_err);
-        if (sql_err != SQLITE_OK) {
-            vocagtk_warn_sql_db(ctx->db);
-        }
+    vocagtk_sync_artists_async(
+        &ctx->dl, ctx->db, artists, VOCAGTK_SYNC_WORKERS,
+        on_sync_progress, ctx, ctx->rss_sync,
+        on_sync_done, ctx
+    );
+    g_ptr_array_unref(artists);
+}
 
-        // 3. Insert song-artist relations into database
-        db_insert_song_artists(ctx->db, song_json, &sql_err);
-        if (sql_err != SQLITE_OK) {
-            vocagtk_warn_sql_db(ctx->db);
-        }
-    }
+// Update the artists in the background, the RSS song list is refreshed
+// once all of them are done. Artists missing in the database are fetched
+// together first, without blocking.
+static void sync_artists(AppState *ctx, int const *ids, gsize n) {
+    if (n == 0) return;
+    ctx->rss_sync = g_cancellable_new();
+    gtk_progress_bar_set_fraction(ctx->rss_progress, 0);
+    gtk_progress_bar_set_text(ctx->rss_progress, NULL);
+    gtk_widget_set_visible(GTK_WIDGET(ctx->rss_progress), true);
+    vocagtk_artist_new_many_async(
+        ids, n, ctx, ctx->rss_sync, on_sync_loaded, ctx
+    );
+}
 
-    // Update artist's update_at timestamp to current time
-    time_t current_time = time(NULL);
-    sql_err = db_artist_update_time(ctx->db, artist_id, current_time);
-    if (sql_err != SQLITE_OK) {
-        vocagtk_warn_sql_db(ctx->db);
-    } else {
-        DEBUG("Updated artist %d update_at to %ld", artist_id, current_time);
-    }
+// Update the artists subscribed while the last update was running
+static void sync_queued(AppState *ctx) {
+    GArray *queued = g_steal_pointer(&ctx->rss_queued);
+    if (!queued) return;
+    DEBUG("Updating %u artists subscribed meanwhile", queued->len);
+    sync_artists(ctx, (int const *) queued->data, queued->len);
+    g_array_unref(queued);
 }
 
 void update_artists(AppState *ctx) {
+    if (ctx->rss_sync) {
+        DEBUG("Artists are being updated already");
+        return;
+    }
     DEBUG("Starting batch update of all subscribed artists");
 
     char const *sql = "SELECT artist_id FROM rss;";
@@ -764,25 +921,50 @@ void update_artists(AppState *ctx) {
 
     DEBUG("Found %d artists to update", artist_ids->len);
 
-    // Update each artist
-    for (guint i = 0; i < artist_ids->len; i++) {
-        int artist_id = g_array_index(artist_ids, int, i);
-        int sql_err = 0;
-
-        VocagtkArtist *artist =
-            db_artist_get_by_id(ctx->db, artist_id, &sql_err);
-        if (!artist) {
-            DEBUG("Could not load artist %d, skipping", artist_id);
-            continue;
-        }
+    sync_artists(ctx, (int const *) artist_ids->data, artist_ids->len);
+    g_array_free(artist_ids, TRUE);
+}
 
-        DEBUG("Updating artist %d (%d/%d)", artist_id, i + 1, artist_ids->len);
-        update_artist(ctx, artist);
-        g_object_unref(artist);
+void stop_artists(AppState *ctx) {
+    if (ctx->rss_poll.source_id) {
+        g_source_remove(ctx->rss_poll.source_id);
+        ctx->rss_poll.source_id = 0;
     }
+    g_clear_pointer(&ctx->rss_queued, g_array_unref);
+    if (!ctx->rss_sync) return;
 
-    g_array_free(artist_ids, TRUE);
-    DEBUG("Finished batch update of all artists");
+    DEBUG("Cancelling the update of artists");
+    g_cancellable_cancel(ctx->rss_sync);
+    // The run commits what it stored once its workers are done
+    while (ctx->rss_sync) g_main_context_iteration(NULL, true);
+}
+
+// Poll the artists which are due, spreading VOCAGTK_POLL_BUDGET of them
+// per hour evenly over time
+static gboolean on_rss_poll(gpointer user_data) {
+    AppState *ctx = (AppState *) user_data;
+
+    gint64 now = g_get_monotonic_time();
+    double elapsed = (double) (now - ctx->rss_poll.last_tick) / G_USEC_PER_SEC;
+    ctx->rss_poll.last_tick = now;
+
+    // Unused budget carries over for one tick, never into a burst
+    double per_tick = (double) VOCAGTK_POLL_BUDGET * VOCAGTK_POLL_TICK / 3600;
+    ctx->rss_poll.credit = MIN(
+        ctx->rss_poll.credit + elapsed * VOCAGTK_POLL_BUDGET / 3600,
+        2 * per_tick
+    );
+    if (ctx->rss_sync || ctx->rss_poll.credit < 1) return G_SOURCE_CONTINUE;
+
+    GArray *due = vocagtk_sync_due(
+        ctx->db, time(NULL), (guint) ctx->rss_poll.credit
+    );
+    if (due->len > 0) {
+        ctx->rss_poll.credit -= due->len;
+        sync_artists(ctx, (int const *) due->data, due->len);
+    }
+    g_array_free(due, true);
+    return G_SOURCE_CONTINUE;
 }
 
 void refresh_rss_song(AppState *ctx) {
@@ -845,21 +1027,44 @@ void watch_entry(VocagtkEntry *entry, EntryListCtx *list_ctx, int position) {
             break;
         }
 
-        VocagtkArtist *artist = vocagtk_artist_new(id, list_ctx->app);
+        // The stored artist keeps its update mark, the entry has none
+        VocagtkArtist *artist = db_artist_get_by_id(
+            list_ctx->app->db, id, &sql_err
+        );
+        if (!artist) {
+            artist = g_object_ref(entry->entry.artist);
+            if (db_artist_add(list_ctx->app->db, artist) != SQLITE_OK) {
+                vocagtk_warn_sql_db(list_ctx->app->db);
+            }
+        }
 
         if (inserted > 0) {
-            // Newly inserted, add to UI list
+            // Newly inserted, add to UI list, the entry takes the artist
             VocagtkEntry *new_entry = vocagtk_entry_new_artist(artist);
             g_list_store_append(list_ctx->app->rss_artist, new_entry);
             g_object_unref(new_entry);
         } else {
             DEBUG("Artist %d already subscribed", id);
+            g_object_unref(artist);
         }
 
-        // Always update artist's songs and refresh RSS song list
-        // (artist may have new songs even if already subscribed)
-        update_artist(list_ctx->app, artist);
-        refresh_rss_song(list_ctx->app);
+        // Always update artist's songs, the RSS song list is refreshed
+        // once it is done (artist may have new songs even if already
+        // subscribed). A running update takes it once it finished.
+        AppState *app = list_ctx->app;
+        if (!app->rss_sync) {
+            sync_artists(app, &id, 1);
+            break;
+        }
+        DEBUG("Artists are being updated, artist %d queued", id);
+        if (!app->rss_queued) {
+            app->rss_queued = g_array_new(false, false, sizeof(int));
+        }
+        bool queued = false;
+        for (guint i = 0; i < app->rss_queued->len; i++) {
+            queued |= g_array_index(app->rss_queued, int, i) == id;
+        }
+        if (!queued) g_array_append_val(app->rss_queued, id);
 
         break;
     case VOCAGTK_ENTRY_TYPE_LABEL_SONG:
@@ -989,34 +1194,229 @@ void call_init_rss_artist(AppState *ctx) {
     sqlite3_finalize(stmt);
 }
 
-/*void call_update_rss_song(AppState *ctx, int artist_id) {
-    int sql_err = SQLITE_OK;
-    CURLcode curl_err = CURLE_OK;
+struct _SearchRun {
+    AppState *app;
+    char *query; // as typed, sent to VocaDB
+    char *key; // normalised query, the cache key together with entry_type
+    char *entry_type;
+    size_t offset; // start of the first page which is not listed yet
+    VocagtkResultIterator iter; // requests the pages from offset on
+    bool online; // iter was started
+    GCancellable *cancellable; // aborts the pages once the query is stale
+    guint wanted; // results to append before waiting for the scroll
+    bool pending; // a next_async call is in flight
+    bool done;
+    GHashTable *listed; // type << 32 | id of every entry in the list
+    GArray *page; // DbSearchHit of the page being downloaded
+    size_t page_start;
+};
+
+static void search_run_free(SearchRun *run) {
+    vocagtk_result_iterator_clear(&run->iter);
+    g_object_unref(run->cancellable);
+    g_hash_table_unref(run->listed);
+    g_array_free(run->page, true);
+    g_free(run->query);
+    g_free(run->key);
+    g_free(run->entry_type);
+    g_free(run);
+}
 
-    time_t last_update = db_rss_get_update_time(ctx->db, artist_id, &sql_err);
+// Cache key of a query, the same for queries differing only in case,
+// Unicode compatibility forms or spacing
+static char *search_normalize(char const *query) {
+    char *nfkc = g_utf8_normalize(query, -1, G_NORMALIZE_NFKC);
+    char *folded = g_utf8_casefold(nfkc ? nfkc : query, -1);
+    g_free(nfkc);
+
+    GString *key = g_string_new(NULL);
+    char **words = g_strsplit_set(folded, " \t\n", -1);
+    for (char **word = words; *word; word++) {
+        if (!**word) continue;
+        if (key->len) g_string_append_c(key, ' ');
+        g_string_append(key, *word);
+    }
+    g_strfreev(words);
+    g_free(folded);
+    return g_string_free(key, false);
+}
 
-    VocagtkResultIterator it;
-    vocagtk_downloader_update(artist_id, last_update, &it);
+// Append entry unless it is listed already, stored entries come first and
+// the remote results merge in behind them
+static bool search_run_append(SearchRun *run, VocagtkEntry *entry) {
+    gint64 *key = g_new(gint64, 1);
+    *key = (gint64) entry->type_label << 32 | (guint32) entry_get_id(entry);
+    if (!g_hash_table_add(run->listed, key)) return false;
 
-    yyjson_val *song_json = NULL;
-    while ((song_json = vocagtk_result_iterator_next(&it, &ctx->dl,
-        &curl_err)) != NULL) {
-        db_insert_song_albums(ctx->db, song_json, &sql_err);
-        db_insert_song_artists(ctx->db, song_json, &sql_err);
+    g_list_store_append(run->app->search_widgets.list, entry);
+    return true;
+}
 
-        VocagtkSong *song = json_to_song(song_json);
-        if (!song) continue;
+// Remember the page being downloaded, next_start is -1 after the last one
+static void search_run_flush(SearchRun *run, gint64 next_start) {
+    db_search_cache_put(
+        run->app->db, run->key, run->entry_type, run->page_start,
+        (DbSearchHit const *) run->page->data, run->page->len,
+        next_start, VOCAGTK_SEARCH_CACHE_TTL
+    );
+    g_array_set_size(run->page, 0);
+}
 
-        VocagtkEntry *entry = vocagtk_entry_new_song(song);
-        if (entry) {
-            g_list_store_append(ctx->rss_song, entry);
-            g_object_unref(entry);
+static void search_run_online(SearchRun *run) {
+    VocagtkSearchQuery q = {
+        .query = run->query,
+        .entry_type = run->entry_type,
+        .start = run->offset,
+    };
+    vocagtk_downloader_search(&q, &run->iter);
+    vocagtk_result_iterator_set_cancellable(&run->iter, run->cancellable, 0);
+    run->online = true;
+    run->page_start = run->offset;
+    DEBUG("Search \"%s\" goes online at %zu", run->query, run->offset);
+}
+
+// List the cached page at offset. A fresh page saves its request, a stale
+// or missing one starts the remote search from there.
+static void search_run_cached(SearchRun *run) {
+    AppState *ctx = run->app;
+    GArray *hits = g_array_new(false, false, sizeof(DbSearchHit));
+    gint64 next_start = -1;
+    bool fresh = false;
+    int rcode = db_search_cache_get(
+        ctx->db, run->key, run->entry_type, run->offset,
+        hits, &next_start, &fresh
+    );
+
+    if (rcode == SQLITE_ROW) {
+        GPtrArray *entries = g_ptr_array_new_with_free_func(g_object_unref);
+        db_entry_get_hits(
+            ctx->db, (DbSearchHit const *) hits->data, hits->len, entries
+        );
+        for (guint i = 0; i < entries->len; i++) {
+            search_run_append(run, g_ptr_array_index(entries, i));
         }
-        g_object_unref(song);
+        run->wanted -= MIN(run->wanted, hits->len);
+        // Entries which are gone from the database are fetched again
+        fresh = fresh && entries->len == hits->len;
+        g_ptr_array_unref(entries);
     }
-   }*/
 
-void call_search(AppState *ctx) {
+    if (rcode == SQLITE_ROW && fresh) {
+        if (next_start < 0 || (size_t) next_start <= run->offset) {
+            run->done = true;
+        } else {
+            run->offset = (size_t) next_start;
+        }
+    } else {
+        // Revalidate the stale page at least
+        if (rcode == SQLITE_ROW) {
+            run->wanted = MAX(run->wanted, MAX(hits->len, 1));
+        }
+        search_run_online(run);
+    }
+    g_array_free(hits, true);
+}
+
+static void search_run_next(SearchRun *run);
+
+static void on_search_next(GObject *_, GAsyncResult *res, gpointer user_data) {
+    SearchRun *run = user_data;
+    AppState *ctx = run->app;
+    run->pending = false;
+
+    GError *error = NULL;
+    yyjson_val *obj = vocagtk_result_iterator_next_finish(
+        &run->iter, res, &error
+    );
+    if (ctx->search_widgets.run != run) {
+        // A newer query replaced this one while the result was on its way
+        g_clear_error(&error);
+        search_run_free(run);
+        return;
+    }
+    if (!obj) {
+        if (error) {
+            if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                vocagtk_warn_def("Search failed: %s", error->message);
+            }
+            g_error_free(error);
+        } else {
+            search_run_flush(run, -1);
+        }
+        run->done = true;
+        return;
+    }
+
+    if (run->iter.item_page != run->page_start) {
+        // The previous page arrived completely
+        search_run_flush(run, (gint64) run->iter.item_page);
+        run->page_start = run->iter.item_page;
+    }
+
+    VocagtkEntry *entry = json_to_entry(obj);
+    if (entry) {
+        DbSearchHit hit = {
+            .type = entry->type_label,
+            .id = entry_get_id(entry),
+        };
+        g_array_append_val(run->page, hit);
+    }
+    if (entry && search_run_append(run, entry)) {
+        // Save the entry to local database
+        int rcode = db_entry_add(ctx->db, entry);
+        if (rcode != SQLITE_OK) {
+            vocagtk_warn_sql_db(ctx->db);
+        }
+    }
+    if (entry) g_object_unref(entry);
+    if (run->wanted > 0) run->wanted--;
+    search_run_next(run);
+}
+
+static void search_run_next(SearchRun *run) {
+    while (!run->online && !run->done && run->wanted > 0) {
+        search_run_cached(run);
+    }
+    if (
+        !run->online || run->pending || run->done
+        || run->wanted == 0
+    ) {
+        return;
+    }
+    run->pending = true;
+    vocagtk_result_iterator_next_async(
+        &run->iter, &run->app->dl, NULL, on_search_next, run
+    );
+}
+
+// Load another batch while less than a screen of results is left below,
+// also fills the list when the first batch doesn't cover the screen
+static void on_search_scrolled(GtkAdjustment *adj, AppState *ctx) {
+    SearchRun *run = ctx->search_widgets.run;
+    if (!run || run->done) return;
+
+    double page = gtk_adjustment_get_page_size(adj);
+    double left = gtk_adjustment_get_upper(adj)
+        - gtk_adjustment_get_value(adj) - page;
+    if (left > page) return;
+
+    run->wanted = MAX(run->wanted, VOCAGTK_SEARCH_BATCH);
+    search_run_next(run);
+}
+
+// Abort the running query and clear its results, a pending call frees the
+// query once it fails
+static void search_cancel(AppState *ctx) {
+    SearchRun *old = ctx->search_widgets.run;
+    if (old && old->pending) g_cancellable_cancel(old->cancellable);
+    else if (old) search_run_free(old);
+    ctx->search_widgets.run = NULL;
+
+    g_list_store_remove_all(ctx->search_widgets.list);
+}
+
+// Replace the running query with the one in the field
+static void search_start(AppState *ctx) {
     char const *query_str =
         gtk_editable_get_text(GTK_EDITABLE(ctx->search_widgets.field));
     if (!query_str) query_str = "Hello";
@@ -1028,34 +1428,38 @@ void call_search(AppState *ctx) {
     if (sel_obj) entry_type = gtk_string_object_get_string(sel_obj);
     if (g_strcmp0(entry_type, "Anything") == 0) entry_type = "";
 
-    VocagtkSearchQuery q = {
-        .query = query_str,
-        .entry_type = entry_type,
-    };
-
-    g_list_store_remove_all(ctx->search_widgets.list);
-
-    VocagtkResultIterator it;
-    vocagtk_downloader_search(&q, &it);
-
-    CURLcode curl_err = CURLE_OK;
-    yyjson_val *obj = NULL;
-    while (
-         (obj = vocagtk_result_iterator_next(&it, &ctx->dl, &curl_err))
-         != NULL
-    ) {
-        if (curl_err != CURLE_OK) vocagtk_warn_curl_rcode(curl_err);
-        VocagtkEntry *entry = json_to_entry(obj);
-        if (!entry) continue;
-
-        // Save the entry to local database
-        int rcode = db_entry_add(ctx->db, entry);
-        if (rcode != SQLITE_OK) {
-            vocagtk_warn_sql_db(ctx->db);
-        }
+    search_cancel(ctx);
 
-        g_list_store_append(ctx->search_widgets.list, entry);
-        g_object_unref(entry);
+    SearchRun *run = g_new0(SearchRun, 1);
+    run->app = ctx;
+    run->query = g_strdup(query_str);
+    run->key = search_normalize(query_str);
+    run->entry_type = g_strdup(entry_type);
+    run->cancellable = g_cancellable_new();
+    run->listed = g_hash_table_new_full(
+        g_int64_hash, g_int64_equal, g_free, NULL
+    );
+    run->page = g_array_new(false, false, sizeof(DbSearchHit));
+    ctx->search_widgets.run = run;
+
+    // What is stored already shows up at once, then the cached pages of
+    // the same query. The network is only asked when they don't fill the
+    // first batch, are stale or the list is scrolled past them.
+    GPtrArray *local = g_ptr_array_new_with_free_func(g_object_unref);
+    db_entry_search(
+        ctx->db, query_str, entry_type, VOCAGTK_SEARCH_LOCAL_LIMIT, local
+    );
+    for (guint i = 0; i < local->len; i++) {
+        search_run_append(run, g_ptr_array_index(local, i));
     }
+    DEBUG("Search \"%s\": %u stored entries", query_str, local->len);
+    run->wanted = local->len < VOCAGTK_SEARCH_BATCH
+        ? VOCAGTK_SEARCH_BATCH - local->len : 0;
+    g_ptr_array_unref(local);
 
+    search_run_next(run);
+}
+
+void call_search(AppState *ctx) {
+    search_start(ctx);
 }
@@ -8,6 +8,7 @@
 #include "db.h"
 #include "entrybox.h"
 #include "exterr.h"
+#include "thumb.h"
 #include "ui.h"
 
 /*
@@ -25,6 +26,11 @@ typedef struct {
     GListStore *results;
 } SearchState;
 
+static gboolean on_close_request(GtkWindow *window, AppState *ctx) {
+    stop_artists(ctx);
+    return false;
+}
+
 static void activate(GtkApplication *app, AppState *ctx) {
     GtkBuilder *builder = gtk_builder_new_from_resource(
         "/moe/florious0721/vocagtk/ui/main.ui"
@@ -38,6 +44,11 @@ static void activate(GtkApplication *app, AppState *ctx) {
     build_rss_song_box(builder, ctx);
     build_playlist(builder, ctx);
 
+    // Updates write to the database closed once the window is gone
+    g_signal_connect(
+        window, "close-request", G_CALLBACK(on_close_request), ctx
+    );
+
     gtk_window_set_application(GTK_WINDOW(window), app);
     gtk_widget_set_visible(GTK_WIDGET(window), TRUE);
 
@@ -131,11 +142,31 @@ static sqlite3 *init_database(void) {
         "ON UPDATE CASCADE ON DELETE CASCADE"
         ");",
 
+        "CREATE TABLE IF NOT EXISTS sync_progress("
+        "artist_id INTEGER PRIMARY KEY,"
+        "since INTEGER, next_start INTEGER, newest INTEGER,"
+        "last_song_id INTEGER,"
+        "FOREIGN KEY (artist_id) REFERENCES artist(id)"
+        "ON UPDATE CASCADE ON DELETE CASCADE"
+        ");",
+
+        "CREATE TABLE IF NOT EXISTS search_cache("
+        "query TEXT, entry_type TEXT, start INTEGER,"
+        "hits TEXT, next_start INTEGER, expires_at INTEGER,"
+        "PRIMARY KEY(query, entry_type, start)"
+        ");",
+
+        "CREATE TABLE IF NOT EXISTS rss_poll("
+        "artist_id INTEGER PRIMARY KEY, polled_at INTEGER,"
+        "FOREIGN KEY (artist_id) REFERENCES artist(id)"
+        "ON UPDATE CASCADE ON DELETE CASCADE"
+        ");",
+
         //"INSERT OR IGNORE INTO playlist(name) VALUES('Default');",
     };
 
     char *errmsg;
-    for (int i = 0; i < 9; ++i) {
+    for (gsize i = 0; i < G_N_ELEMENTS(sqls); ++i) {
         if (sqlite3_exec(r, sqls[i], NULL, NULL, &errmsg) != SQLITE_OK) {
             vocagtk_warn_sql("%s", errmsg);
         }
@@ -165,12 +196,12 @@ int main(int argc, char **argv) {
         goto clean;
     }
 
-    state.dl.cache_path = "./cache/";
-    state.dl.handle = curl_easy_init();
-    if (!state.dl.handle) {
+    if (!vocagtk_downloader_init(&state.dl, "./cache/")) {
         status = 1;
         goto clean;
     }
+    // Opt-in, thumbnails then live in a pack file instead of a file each
+    if (g_getenv("VOCAGTK_THUMB_PACK")) vocagtk_thumb_pack_open(&state.dl);
 
     state.playlists = gtk_string_list_new(NULL);
 
@@ -209,7 +240,9 @@ int main(int argc, char **argv) {
 
 clean:
     if (app) g_object_unref(app);
-    if (state.dl.handle) curl_easy_cleanup(state.dl.handle);
+    vocagtk_thumb_pack_close(&state.dl);
+    vocagtk_downloader_clear(&state.dl);
+    vocagtk_thumb_cache_clear();
     if (state.db) sqlite3_close(state.db);
     if (state.playlists) g_object_unref(state.playlists);
     //if (headers) curl_slist_free_all(headers);
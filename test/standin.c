@@ -0,0 +1,345 @@
+#include <curl/curl.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Stand-in for the VocaDB API and its image host. It replays recorded
+// responses so network behaviour can be measured without network access,
+// and can make the link slow or flaky on purpose.
+//
+//   standin --record https://vocadb.net   # record whatever is missing
+//   standin --latency 80 --bandwidth 256  # replay over a slow link
+//
+// Point vocagtk at it with
+//   VOCAGTK_API_BASE=http://127.0.0.1:8642
+//   VOCAGTK_IMAGE_BASE=http://127.0.0.1:8642/img
+//
+// Responses are stored in --dir, one file per request target named after
+// its SHA-1. Images are requested as /img/<host>/<path>. With --port 0 a
+// free port is picked, the port listened on is printed to stdout either way.
+
+static gint port = 8642;
+static gchar *dir = "recordings";
+static gchar *upstream = NULL; // record mode if set
+static gint latency_ms = 0;
+static gint jitter_ms = 0;
+static gint bandwidth_kib = 0; // per connection, 0 for unlimited
+static gdouble error_rate = 0;
+static gint error_status = 503;
+static gboolean gzip = FALSE;
+
+static GOptionEntry const options[] = {
+    {
+        "port", 'p', 0, G_OPTION_ARG_INT, &port,
+        "Port to listen on, 0 for any free one", "PORT"
+    },
+    {"dir", 'd', 0, G_OPTION_ARG_FILENAME, &dir, "Recordings directory", "DIR"},
+    {
+        "record", 'r', 0, G_OPTION_ARG_STRING, &upstream,
+        "Fetch missing responses from this API base and record them", "URL"
+    },
+    {
+        "latency", 'l', 0, G_OPTION_ARG_INT, &latency_ms,
+        "Delay before every response", "MS"
+    },
+    {
+        "jitter", 'j', 0, G_OPTION_ARG_INT, &jitter_ms,
+        "Random extra delay, up to", "MS"
+    },
+    {
+        "bandwidth", 'b', 0, G_OPTION_ARG_INT, &bandwidth_kib,
+        "Cap every connection at this rate", "KIB/S"
+    },
+    {
+        "error-rate", 'e', 0, G_OPTION_ARG_DOUBLE, &error_rate,
+        "Fraction of requests failing with --error-status", "RATE"
+    },
+    {
+        "error-status", 's', 0, G_OPTION_ARG_INT, &error_status,
+        "Status of injected failures, 503 by default", "STATUS"
+    },
+    {"gzip", 'z', 0, G_OPTION_ARG_NONE, &gzip, "Compress bodies when accepted", NULL},
+    G_OPTION_ENTRY_NULL
+};
+
+typedef struct {
+    char *target; // path and query
+    bool keep_alive;
+    bool accepts_gzip;
+} Request;
+
+static char const *reason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+// Returns false once the client closed the connection
+static bool read_request(GDataInputStream *in, Request *req, bool *valid) {
+    memset(req, 0, sizeof(*req));
+    *valid = false;
+
+    char *line = g_data_input_stream_read_line(in, NULL, NULL, NULL);
+    if (!line) return false;
+    char **parts = g_strsplit(line, " ", 3);
+    if (g_strv_length(parts) == 3 && strcmp(parts[0], "GET") == 0) {
+        req->target = g_strdup(parts[1]);
+        req->keep_alive = strcmp(parts[2], "HTTP/1.0") != 0;
+        *valid = true;
+    }
+    g_strfreev(parts);
+    g_free(line);
+
+    while ((line = g_data_input_stream_read_line(in, NULL, NULL, NULL))) {
+        if (!*line) {
+            g_free(line);
+            return true;
+        }
+        char *value = strchr(line, ':');
+        if (value) {
+            *value++ = '\0';
+            g_strstrip(value);
+            if (g_ascii_strcasecmp(line, "Connection") == 0) {
+                req->keep_alive = g_ascii_strcasecmp(value, "close") != 0;
+            } else if (g_ascii_strcasecmp(line, "Accept-Encoding") == 0) {
+                req->accepts_gzip = strstr(value, "gzip") != NULL;
+            }
+        }
+        g_free(line);
+    }
+    return false;
+}
+
+static size_t fetch_write_cb(char *data, size_t size, size_t n, void *userp) {
+    g_byte_array_append(userp, (guint8 const *) data, size * n);
+    return size * n;
+}
+
+static GBytes *fetch_upstream(char const *target, int *status) {
+    char *url = g_str_has_prefix(target, "/img/")
+        ? g_strconcat("https://", target + strlen("/img/"), NULL)
+        : g_strconcat(upstream, target, NULL);
+
+    GByteArray *body = g_byte_array_new();
+    CURL *handle = curl_easy_init();
+    curl_easy_setopt(handle, CURLOPT_URL, url);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, fetch_write_cb);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, body);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+
+    long code = 0;
+    CURLcode rcode = curl_easy_perform(handle);
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_cleanup(handle);
+
+    if (rcode != CURLE_OK) {
+        g_warning("%s: %s", url, curl_easy_strerror(rcode));
+        code = 502;
+    }
+    *status = (int) code;
+    g_free(url);
+    return g_byte_array_free_to_bytes(body);
+}
+
+static GBytes *lookup(char const *target, int *status) {
+    char *sum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, target, -1);
+    char *path = g_build_filename(dir, sum, NULL);
+    g_free(sum);
+
+    GBytes *body = NULL;
+    char *data = NULL;
+    gsize len = 0;
+    if (g_file_get_contents(path, &data, &len, NULL)) {
+        body = g_bytes_new_take(data, len);
+        *status = 200;
+    } else if (upstream) {
+        body = fetch_upstream(target, status);
+        if (*status == 200) {
+            gconstpointer p = g_bytes_get_data(body, &len);
+            if (g_file_set_contents(path, p, len, NULL)) {
+                g_message("Recorded %s", target);
+            } else {
+                g_warning("Failed to record %s into %s", target, path);
+            }
+        }
+    } else {
+        g_message("Not recorded: %s", target);
+        *status = 404;
+    }
+    g_free(path);
+    return body;
+}
+
+static GBytes *gzip_bytes(GBytes *body) {
+    GZlibCompressor *z = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    GOutputStream *mem = g_memory_output_stream_new_resizable();
+    GOutputStream *out = g_converter_output_stream_new(mem, G_CONVERTER(z));
+
+    gsize len = 0;
+    gconstpointer data = g_bytes_get_data(body, &len);
+    g_output_stream_write_all(out, data, len, NULL, NULL, NULL);
+    g_output_stream_close(out, NULL, NULL); // closes mem as well
+
+    GBytes *r = g_memory_output_stream_steal_as_bytes(
+        G_MEMORY_OUTPUT_STREAM(mem)
+    );
+    g_object_unref(out);
+    g_object_unref(mem);
+    g_object_unref(z);
+    return r;
+}
+
+static bool write_throttled(GOutputStream *out, guint8 const *data, gsize len) {
+    if (bandwidth_kib <= 0) {
+        return g_output_stream_write_all(out, data, len, NULL, NULL, NULL);
+    }
+
+    // About ten writes a second
+    gsize rate = (gsize) bandwidth_kib * 1024;
+    gsize chunk = MAX(rate / 10, 1);
+    for (gsize off = 0; off < len; off += chunk) {
+        gsize n = MIN(chunk, len - off);
+        if (!g_output_stream_write_all(out, data + off, n, NULL, NULL, NULL)) {
+            return false;
+        }
+        g_usleep(n * G_USEC_PER_SEC / rate);
+    }
+    return true;
+}
+
+static bool respond(GOutputStream *out, Request const *req, bool valid) {
+    gint64 delay = latency_ms;
+    if (jitter_ms > 0) delay += g_random_int_range(0, jitter_ms + 1);
+    if (delay > 0) g_usleep(delay * 1000);
+
+    int status = 400;
+    GBytes *body = NULL;
+    if (valid && error_rate > 0 && g_random_double() < error_rate) {
+        status = error_status;
+    } else if (valid) {
+        body = lookup(req->target, &status);
+    }
+    if (status != 200) g_clear_pointer(&body, g_bytes_unref);
+    if (!body) body = g_bytes_new_static("", 0);
+
+    bool compressed = gzip && req->accepts_gzip && g_bytes_get_size(body) > 0;
+    if (compressed) {
+        GBytes *z = gzip_bytes(body);
+        g_bytes_unref(body);
+        body = z;
+    }
+
+    GString *head = g_string_new(NULL);
+    g_string_append_printf(head, "HTTP/1.1 %d %s\r\n", status, reason(status));
+    if (status == 200) {
+        bool api = g_str_has_prefix(req->target, "/api/");
+        g_string_append_printf(
+            head, "Content-Type: %s\r\n",
+            api ? "application/json; charset=utf-8" : "application/octet-stream"
+        );
+    }
+    if (compressed) g_string_append(head, "Content-Encoding: gzip\r\n");
+    if (status == 429 || status == 503) g_string_append(head, "Retry-After: 1\r\n");
+    g_string_append_printf(
+        head, "Content-Length: %" G_GSIZE_FORMAT "\r\n", g_bytes_get_size(body)
+    );
+    g_string_append_printf(
+        head, "Connection: %s\r\n\r\n", req->keep_alive ? "keep-alive" : "close"
+    );
+
+    gsize len = 0;
+    guint8 const *data = g_bytes_get_data(body, &len);
+    bool ok = write_throttled(out, (guint8 const *) head->str, head->len)
+        && write_throttled(out, data, len);
+
+    g_string_free(head, TRUE);
+    g_bytes_unref(body);
+    return ok;
+}
+
+static gboolean serve(
+    GThreadedSocketService *service, GSocketConnection *conn,
+    GObject *source, gpointer user_data
+) {
+    GIOStream *io = G_IO_STREAM(conn);
+    GDataInputStream *in = g_data_input_stream_new(g_io_stream_get_input_stream(io));
+    g_data_input_stream_set_newline_type(in, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+    GOutputStream *out = g_io_stream_get_output_stream(io);
+
+    Request req;
+    bool valid;
+    while (read_request(in, &req, &valid)) {
+        bool ok = respond(out, &req, valid);
+        g_clear_pointer(&req.target, g_free);
+        if (!ok || !valid || !req.keep_alive) break;
+    }
+    g_free(req.target);
+
+    g_object_unref(in);
+    return TRUE;
+}
+
+int main(int argc, char **argv) {
+    GError *error = NULL;
+    GOptionContext *octx = g_option_context_new("- VocaDB stand-in server");
+    g_option_context_add_main_entries(octx, options, NULL);
+    if (!g_option_context_parse(octx, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(octx);
+
+    if (g_mkdir_with_parents(dir, 0755) != 0) {
+        g_printerr("Failed to create %s\n", dir);
+        return 1;
+    }
+    if (upstream && g_str_has_suffix(upstream, "/")) {
+        upstream[strlen(upstream) - 1] = '\0';
+    }
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // A thread per connection keeps blocking sleeps simple
+    GSocketService *service = g_threaded_socket_service_new(-1);
+    GSocketAddress *addr = g_inet_socket_address_new_from_string(
+        "127.0.0.1", port
+    );
+    GSocketAddress *bound_addr = NULL;
+    bool bound = g_socket_listener_add_address(
+        G_SOCKET_LISTENER(service), addr,
+        G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP,
+        NULL, &bound_addr, &error
+    );
+    g_object_unref(addr);
+    if (!bound) {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
+    port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(bound_addr));
+    g_object_unref(bound_addr);
+    // Read by whoever started us on port 0, connections queue from now on
+    g_print("%d\n", port);
+    fflush(stdout);
+    g_signal_connect(service, "run", G_CALLBACK(serve), NULL);
+
+    g_message(
+        "Serving %s on http://127.0.0.1:%d%s%s", dir, port,
+        upstream ? ", recording from " : "", upstream ? upstream : ""
+    );
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    g_main_loop_run(loop);
+
+    g_main_loop_unref(loop);
+    g_object_unref(service);
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,320 @@
+#include <curl/curl.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dl.h"
+#include "helper.h"
+#include "httpcache.h"
+#include "jsonstream.h"
+#include "ratelimit.h"
+
+// Checks of the pieces the network code is built from, and a replay of
+// recorded result pages through test/standin.c, whose path meson passes in
+// VOCAGTK_STANDIN. Nothing here needs network access.
+
+static void remove_tree(char const *path) {
+    GDir *dir = g_dir_open(path, 0, NULL);
+    char const *name;
+    while (dir && (name = g_dir_read_name(dir))) {
+        char *child = g_build_filename(path, name, NULL);
+        remove_tree(child);
+        g_free(child);
+    }
+    if (dir) g_dir_close(dir);
+    g_remove(path);
+}
+
+static void test_json_stream(void) {
+    // Brackets and quotes inside strings must not confuse the splitter
+    char const page[] =
+        "{\"items\": [{\"id\": 1, \"name\": \"a]}\"}, "
+        "{\"id\": 2, \"name\": \"\\\"[{\"}], \"totalCount\": 2}";
+
+    VocagtkJsonStream stream;
+    vocagtk_json_stream_init(&stream);
+    // A byte at a time, as badly as the network may split it
+    for (size_t i = 0; i < sizeof(page) - 1; i++) {
+        vocagtk_json_stream_feed(&stream, page + i, 1);
+    }
+    g_assert_cmpuint(stream.n_items, ==, 2);
+
+    yyjson_doc *doc = vocagtk_json_stream_pop(&stream);
+    g_assert_nonnull(doc);
+    yyjson_val *root = yyjson_doc_get_root(doc);
+    g_assert_cmpint(yyjson_get_int(yyjson_obj_get(root, "id")), ==, 1);
+    g_assert_cmpstr(yyjson_get_str(yyjson_obj_get(root, "name")), ==, "a]}");
+    yyjson_doc_free(doc);
+
+    doc = vocagtk_json_stream_pop(&stream);
+    g_assert_nonnull(doc);
+    root = yyjson_doc_get_root(doc);
+    g_assert_cmpint(yyjson_get_int(yyjson_obj_get(root, "id")), ==, 2);
+    g_assert_cmpstr(yyjson_get_str(yyjson_obj_get(root, "name")), ==, "\"[{");
+    yyjson_doc_free(doc);
+    g_assert_null(vocagtk_json_stream_pop(&stream));
+
+    doc = vocagtk_json_stream_envelope(&stream);
+    g_assert_nonnull(doc);
+    root = yyjson_doc_get_root(doc);
+    g_assert_cmpint(yyjson_get_int(yyjson_obj_get(root, "totalCount")), ==, 2);
+    g_assert_cmpuint(yyjson_arr_size(yyjson_obj_get(root, "items")), ==, 0);
+    yyjson_doc_free(doc);
+
+    vocagtk_json_stream_clear(&stream);
+}
+
+static void test_rate_limiter(void) {
+    VocagtkRateLimiter rl;
+    vocagtk_rate_limiter_init(&rl);
+
+    // The burst goes through at once, later starts are paced
+    for (int i = 0; i < (int) VOCAGTK_RATE_BURST; i++) {
+        g_assert_cmpint(vocagtk_rate_limiter_acquire(&rl, false), ==, 0);
+    }
+    gint64 wait = vocagtk_rate_limiter_acquire(&rl, false);
+    g_assert_cmpint(wait, >, 0);
+    g_assert_cmpint(wait, <=, G_USEC_PER_SEC / VOCAGTK_RATE_INITIAL + 1);
+
+    // A throttled answer halves the rate and the window, its Retry-After
+    // holds every start back
+    double rate = rl.rate;
+    double window = rl.window;
+    vocagtk_rate_limiter_release(&rl, false, VOCAGTK_RATE_THROTTLED, 2);
+    g_assert_cmpfloat(rl.rate, ==, MAX(VOCAGTK_RATE_MIN, rate / 2));
+    g_assert_cmpfloat(rl.window, ==, MAX(1.0, window / 2));
+    g_assert_cmpuint(rl.throttled, ==, 1);
+    g_assert_cmpint(vocagtk_rate_limiter_acquire(&rl, false), >, G_USEC_PER_SEC);
+}
+
+static void test_rate_window(void) {
+    VocagtkRateLimiter rl;
+    vocagtk_rate_limiter_init(&rl);
+
+    for (int i = 0; i < (int) VOCAGTK_RATE_WINDOW_INITIAL; i++) {
+        g_assert_cmpint(vocagtk_rate_limiter_acquire(&rl, true), ==, 0);
+    }
+    // Only a release frees a slot
+    g_assert_cmpint(vocagtk_rate_limiter_acquire(&rl, true), ==, -1);
+
+    vocagtk_rate_limiter_release(&rl, true, VOCAGTK_RATE_OK, 0);
+    g_assert_cmpfloat(rl.window, >, VOCAGTK_RATE_WINDOW_INITIAL);
+    g_assert_cmpint(vocagtk_rate_limiter_acquire(&rl, true), ==, 0);
+}
+
+static void test_http_cache(void) {
+    char *dir = g_dir_make_tmp("vocagtk-test-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+    char *path = g_build_filename(dir, "http.db", NULL);
+
+    VocagtkHttpCache cache;
+    g_assert_true(
+        vocagtk_http_cache_open(&cache, path, VOCAGTK_HTTP_CACHE_MAX_BYTES)
+    );
+    char const *url = "http://127.0.0.1/api/songs/1";
+    char const body[] = "{\"id\": 1}";
+    g_assert_null(vocagtk_http_cache_lookup(&cache, url));
+
+    // Stale right away, it comes back with what revalidates it
+    vocagtk_http_cache_store(
+        &cache, url, (guint8 const *) body, strlen(body), "\"v1\"", NULL, 0
+    );
+    VocagtkHttpCacheEntry *entry = vocagtk_http_cache_lookup(&cache, url);
+    g_assert_nonnull(entry);
+    g_assert_false(entry->fresh);
+    g_assert_cmpstr(entry->etag, ==, "\"v1\"");
+    g_assert_null(entry->last_modified);
+    vocagtk_http_cache_entry_free(entry);
+
+    // What a 304 Not Modified does, the body stays as it was
+    vocagtk_http_cache_refresh(&cache, url, 60);
+    entry = vocagtk_http_cache_lookup(&cache, url);
+    g_assert_nonnull(entry);
+    g_assert_true(entry->fresh);
+    gsize len = 0;
+    gconstpointer data = g_bytes_get_data(entry->body, &len);
+    g_assert_cmpmem(data, len, body, strlen(body));
+    vocagtk_http_cache_entry_free(entry);
+
+    g_assert_cmpuint(cache.revalidated, ==, 1);
+    g_assert_cmpuint(cache.hits, ==, 1);
+    g_assert_cmpuint(cache.misses, ==, 2);
+
+    vocagtk_http_cache_close(&cache);
+    remove_tree(dir);
+    g_free(path);
+    g_free(dir);
+}
+
+// Record a page of the song search for query, the ids of its n items
+// counting up from first
+static void record_page(
+    char const *dir, char const *query,
+    size_t start, int first, int n
+) {
+    char *target = g_strdup_printf(
+        "/api/entries?fields=MainPicture&query=%s&entryTypes=Song"
+        "&start=%zu&maxResults=%d",
+        query, start, VOCAGTK_DOWNLOADER_PAGE_SIZE
+    );
+    GString *body = g_string_new("{\"items\": [");
+    for (int i = 0; i < n; i++) {
+        g_string_append_printf(
+            body, "%s{\"id\": %d, \"name\": \"Song %d\", \"entryType\": \"Song\"}",
+            i ? ", " : "", first + i, first + i
+        );
+    }
+    g_string_append(body, "]}");
+
+    // Named the way the stand-in looks them up
+    char *sum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, target, -1);
+    char *path = g_build_filename(dir, sum, NULL);
+    g_assert_true(g_file_set_contents(path, body->str, body->len, NULL));
+
+    g_free(path);
+    g_free(sum);
+    g_string_free(body, TRUE);
+    g_free(target);
+}
+
+// Start the stand-in on a free port, which is stored in port
+static GSubprocess *standin_start(
+    char const *exe, char const *recordings, int *port
+) {
+    GError *error = NULL;
+    GSubprocess *proc = g_subprocess_new(
+        G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_SILENCE,
+        &error, exe, "--port", "0", "--dir", recordings, NULL
+    );
+    g_assert_no_error(error);
+
+    // Printed once it listens
+    GDataInputStream *out = g_data_input_stream_new(
+        g_subprocess_get_stdout_pipe(proc)
+    );
+    g_filter_input_stream_set_close_base_stream(
+        G_FILTER_INPUT_STREAM(out), false
+    );
+    char *line = g_data_input_stream_read_line(out, NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(line);
+    *port = atoi(line);
+    g_assert_cmpint(*port, >, 0);
+    g_free(line);
+    g_object_unref(out);
+    return proc;
+}
+
+typedef struct {
+    GMainLoop *loop;
+    VocagtkDownloader *dl;
+    VocagtkResultIterator iter;
+    GArray *ids; // of the items, in the order they came
+    GError *error;
+} Replay;
+
+static void replay_next(GObject *_, GAsyncResult *res, gpointer user_data) {
+    Replay *r = user_data;
+    yyjson_val *item = vocagtk_result_iterator_next_finish(
+        &r->iter, res, &r->error
+    );
+    if (!item) {
+        g_main_loop_quit(r->loop);
+        return;
+    }
+    int id = yyjson_get_int(yyjson_obj_get(item, "id"));
+    g_array_append_val(r->ids, id);
+    vocagtk_result_iterator_next_async(&r->iter, r->dl, NULL, replay_next, r);
+}
+
+// Returns the ids of every result of the song search for query
+static GArray *replay_search(VocagtkDownloader *dl, char const *query) {
+    Replay r = {
+        .loop = g_main_loop_new(NULL, FALSE),
+        .dl = dl,
+        .ids = g_array_new(FALSE, FALSE, sizeof(int)),
+    };
+    VocagtkSearchQuery q = {
+        .query = query,
+        .entry_type = "Song",
+        .start = 0,
+    };
+    vocagtk_downloader_search(&q, &r.iter);
+    vocagtk_result_iterator_next_async(&r.iter, dl, NULL, replay_next, &r);
+    g_main_loop_run(r.loop);
+
+    g_assert_no_error(r.error);
+    g_main_loop_unref(r.loop);
+    return r.ids;
+}
+
+static void test_search_replay(void) {
+    char const *exe = g_getenv("VOCAGTK_STANDIN");
+    if (!exe) {
+        g_test_skip("VOCAGTK_STANDIN is not set");
+        return;
+    }
+
+    char *dir = g_dir_make_tmp("vocagtk-test-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+    char *recordings = g_build_filename(dir, "recordings", NULL);
+    char *cache = g_build_filename(dir, "cache", NULL);
+    g_mkdir_with_parents(recordings, 0755);
+
+    // A full page, then a short one which ends the results
+    int const page = VOCAGTK_DOWNLOADER_PAGE_SIZE;
+    record_page(recordings, "miku", 0, 1, page);
+    record_page(recordings, "miku", page, page + 1, 3);
+
+    int port = 0;
+    GSubprocess *standin = standin_start(exe, recordings, &port);
+    char *base = g_strdup_printf("http://127.0.0.1:%d", port);
+    g_setenv("VOCAGTK_API_BASE", base, TRUE);
+    VocagtkDownloader dl;
+    g_assert_true(vocagtk_downloader_init(&dl, cache));
+
+    // Items of both pages in order, streamed while each page arrives
+    GArray *ids = replay_search(&dl, "miku");
+    g_assert_cmpuint(ids->len, ==, page + 3);
+    for (guint i = 0; i < ids->len; i++) {
+        g_assert_cmpint(g_array_index(ids, int, i), ==, (int) i + 1);
+    }
+    g_array_free(ids, TRUE);
+
+    // Without the stand-in both pages come from the HTTP cache
+    g_subprocess_force_exit(standin);
+    g_subprocess_wait(standin, NULL, NULL);
+    guint hits = dl.http_cache.hits;
+    ids = replay_search(&dl, "miku");
+    g_assert_cmpuint(ids->len, ==, page + 3);
+    g_assert_cmpuint(dl.http_cache.hits, ==, hits + 2);
+    g_array_free(ids, TRUE);
+
+    vocagtk_downloader_clear(&dl);
+    g_unsetenv("VOCAGTK_API_BASE");
+    g_object_unref(standin);
+    remove_tree(dir);
+    g_free(base);
+    g_free(cache);
+    g_free(recordings);
+    g_free(dir);
+}
+
+int main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+    // DEBUG is logged at warning level, which g_test_init made fatal
+    g_log_set_always_fatal(G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    g_test_add_func("/jsonstream/split", test_json_stream);
+    g_test_add_func("/ratelimit/pace", test_rate_limiter);
+    g_test_add_func("/ratelimit/window", test_rate_window);
+    g_test_add_func("/httpcache/revalidate", test_http_cache);
+    g_test_add_func("/standin/search", test_search_replay);
+
+    int status = g_test_run();
+    curl_global_cleanup();
+    return status;
+}